@@ -76,17 +76,19 @@ typedef struct {
 
 /* == FORWARD AND INVERSE FFT ===================================== */
 
-// Forward FFT transform
-// Permutation must be performed prior to (DIT)/after (DIF) call
-void fft_forward(fft_complex_t data[], unsigned bits) {
+// One stage (0...bits-1) of the forward FFT transform
+// Calling stages 0 to bits-1 in order is equivalent to fft_forward(), which
+// allows a long transform to be split up into shorter pieces of work
+void fft_forward_stage(fft_complex_t data[], unsigned bits, unsigned stage) {
   unsigned size = 1 << bits;
 #ifdef FFT_DIT
-  unsigned shift = SINE_BITS + 1;
-  for(unsigned stride = 2 ; stride <= size; stride <<= 1, shift--) {
+  unsigned shift = SINE_BITS + 1 - stage;
+  unsigned stride = 2 << stage;
 #else//FFT_DIF
-  unsigned shift = SINE_BITS - (bits - 2);
-  for(unsigned stride = size; stride >= 2; stride >>= 1, shift++) {
+  unsigned shift = SINE_BITS - (bits - 2) + stage;
+  unsigned stride = size >> stage;
 #endif
+  {
     // Twiddle and combine for k = 0, having trivial (0 and 1) twiddle factors
     for(unsigned a = 0; a < size; a += stride) {
       unsigned b = a + (stride >> 1);
@@ -107,9 +109,9 @@ void fft_forward(fft_complex_t data[], unsigned bits) {
         unsigned b = a + (stride >> 1);
         FFT_DECLC(A, data[a]); FFT_DECLC(B, data[b]);
 #ifdef FFT_DIT
-        // # Radix-2 DIT trivial butterfly #
-        FFT_ASSGN(data[b], FFT_D2(FFT_S(FFT(A,r), FFT(B,r))), FFT_D2(FFT_A(FFT(A,i), FFT(B,i))));
-        FFT_ASSGN(data[a], FFT_D2(FFT_A(FFT(A,r), FFT(B,r))), FFT_D2(FFT_S(FFT(A,i), FFT(B,i))));
+        // # Radix-2 DIT trivial butterfly # (twiddle factor -i)
+        FFT_ASSGN(data[b], FFT_D2(FFT_S(FFT(A,r), FFT(B,i))), FFT_D2(FFT_A(FFT(A,i), FFT(B,r))));
+        FFT_ASSGN(data[a], FFT_D2(FFT_A(FFT(A,r), FFT(B,i))), FFT_D2(FFT_S(FFT(A,i), FFT(B,r))));
 #else//FFT_DIF
         // # Radix-2 DIF trivial butterfly #
         FFT_ASSGN(data[a], FFT_D2(FFT_A(FFT(A,r), FFT(B,r))), FFT_D2(FFT_A(FFT(A,i), FFT(B,i))));
@@ -160,6 +162,256 @@ void fft_forward(fft_complex_t data[], unsigned bits) {
   }
 }
 
+// Forward FFT transform
+// Permutation must be performed prior to (DIT)/after (DIF) call
+void fft_forward(fft_complex_t data[], unsigned bits) {
+  for(unsigned stage = 0; stage < bits; stage++)
+    fft_forward_stage(data, bits, stage);
+}
+
+/* == BLOCK FLOATING POINT ======================================== */
+
+// The forward FFT halves the data at every stage, so quiet signals lose
+// precision.  The block floating point (BFP) functions keep the data
+// shifted up to use the whole word, and return the change in a block
+// exponent E, so that data * 2^E is the result the plain functions would
+// give (E is negative when the data has been shifted up).
+
+// Redundant sign bits of the largest value in data[0...size-1]
+// (how far every value could be shifted left without overflow)
+unsigned fft_headroom(fft_complex_t data[], unsigned size) {
+  uint32_t m = 0;
+  for(unsigned n = 0; n < size; n++)
+    m |= (uint32_t)(data[n].r ^ (data[n].r >> 31))
+      | (uint32_t)(data[n].i ^ (data[n].i >> 31));
+  return m ? clz(m) - 1 : 31;
+}
+
+// Shift data so that it has the given headroom (unless it is all zero)
+// Returns the change in block exponent
+int fft_normalise(fft_complex_t data[], unsigned size, unsigned headroom) {
+  int shift = (int)fft_headroom(data, size) - (int)headroom;
+  if(shift == 31 - (int)headroom) return 0;  // all zero
+  if(shift > 0) {
+    for(unsigned n = 0; n < size; n++) {
+      data[n].r <<= shift; data[n].i <<= shift;
+    }
+  } else if(shift < 0) {
+    for(unsigned n = 0; n < size; n++) {
+      data[n].r >>= -shift; data[n].i >>= -shift;
+    }
+  }
+  return -shift;
+}
+
+// One stage of the BFP forward FFT transform
+// A stage can grow the data by up to 1/2 + 1/sqrt(2), so it needs 1 bit of
+// headroom; the data is only shifted if it has none, or has FFT_BFP_SLACK
+// or more bits spare (so that most stages need no shift)
+// Returns the change in block exponent
+#define FFT_BFP_SLACK 3
+int fft_forward_stage_bfp(fft_complex_t data[], unsigned bits, unsigned stage) {
+  int exp = 0;
+  unsigned headroom = fft_headroom(data, 1 << bits);
+  if(headroom < 1 || headroom >= FFT_BFP_SLACK)
+    exp = fft_normalise(data, 1 << bits, 1);
+  fft_forward_stage(data, bits, stage);
+  return exp;
+}
+
+// BFP forward FFT transform
+// Permutation must be performed prior to (DIT)/after (DIF) call
+// Returns the block exponent
+int fft_forward_bfp(fft_complex_t data[], unsigned bits) {
+  int exp = 0;
+  for(unsigned stage = 0; stage < bits; stage++)
+    exp += fft_forward_stage_bfp(data, bits, stage);
+  return exp;
+}
+
+// fft_convert() can grow the data by up to 2 + 2*sqrt(2), so it needs
+// 3 bits of headroom
+#define FFT_CONVERT_HEADROOM 3
+
+/* == RADIX-4 FORWARD FFT ========================================= */
+
+// The analysis only uses a few transform sizes, so these kernels are
+// specialised for 2^FFT_R4_BITS_MIN...2^FFT_R4_BITS_MAX points, with the
+// bit-reversal swaps and twiddle factors worked out once by fft_r4_init()
+// rather than for every transform.  A radix-4 stage does the work of two
+// radix-2 stages in one pass over the data, with 3 complex multiplies for
+// every 4 points instead of 4.  Odd sizes start with one radix-2 stage.
+// The results match the radix-2 fft_forward(), apart from rounding.
+// Left out if FFT_RADIX4 is 0.
+#if (defined FFT_DIT) && FFT_RADIX4
+
+#define FFT_R4_BITS_MIN 6
+#ifndef FFT_R4_BITS_MAX
+#define FFT_R4_BITS_MAX 8     // may be set by the build (up to 10)
+#endif
+#define FFT_R4_SIZE_MAX (1 << FFT_R4_BITS_MAX)
+
+// Index type for the bit-reversal swaps
+#if FFT_R4_BITS_MAX > 8
+typedef uint16_t fft_r4_index_t;
+#else
+typedef uint8_t fft_r4_index_t;
+#endif
+
+// Tables for one transform size
+typedef struct {
+  unsigned bits;                             // 2^bits points (0 = no tables)
+  unsigned nswaps;                           // number of bit-reversal swaps
+  fft_r4_index_t swaps[FFT_R4_SIZE_MAX];     // pairs of indexes to swap
+  fft_complex_t twiddle[3 * FFT_R4_SIZE_MAX / 4]; // W^n for n < 3/4 size
+} fft_r4_t;
+
+// Build the tables for a 2^bits point transform
+// Returns false (and leaves plan->bits 0) if there is no kernel for the size
+bool fft_r4_init(fft_r4_t *plan, unsigned bits) {
+  unsigned size = 1 << bits;
+  plan->bits = 0;
+  plan->nswaps = 0;
+  if(bits < FFT_R4_BITS_MIN || bits > FFT_R4_BITS_MAX || bits > SINE_BITS + 2)
+    return false;
+  for(unsigned i = 1; i < size - 1; i++) {
+    unsigned z = RBITS(i, bits);
+    if(z > i) {
+      plan->swaps[plan->nswaps++] = i;
+      plan->swaps[plan->nswaps++] = z;
+    }
+  }
+  plan->nswaps >>= 1;
+  // W^n = cos + i.sin of 2.PI.n/size - the sine table has an entry for
+  // every angle, so there is no interpolation error
+  for(unsigned n = 0; n < 3 * size / 4; n++) {
+    uint32_t pos = n << (32 - bits);
+    plan->twiddle[n] = (fft_complex_t){ .r = cosine(pos), .i = sine(pos) };
+  }
+  plan->bits = bits;
+  return true;
+}
+
+// Number of fft_r4_stage() calls that make up the transform
+__INLINE
+unsigned fft_r4_stages(const fft_r4_t *plan) {
+  return (plan->bits + 1) >> 1;
+}
+
+// Bit-reversal permutation from the swap table
+// (Must be performed prior to fft_r4_stage())
+void fft_r4_permutate(const fft_r4_t *plan, fft_complex_t data[]) {
+  const fft_r4_index_t *s = plan->swaps;
+  for(unsigned n = plan->nswaps; n; n--, s += 2) {
+    fft_complex_t t = data[s[0]]; data[s[0]] = data[s[1]]; data[s[1]] = t;
+  }
+}
+
+// Multiply B by the conjugate of W, and halve (as the radix-2 DIT butterfly)
+#define FFT_R4_MULR(B, W) FFT_MA(FFT(B,i), FFT(W,i), FFT_M(FFT(B,r), FFT(W,r)))
+#define FFT_R4_MULI(B, W) FFT_MS(FFT(B,r), FFT(W,i), FFT_M(FFT(B,i), FFT(W,r)))
+
+// One radix-4 stage, combining groups of 4 quarter-length (2^stage) DFTs
+// The size is a constant in each of the kernels below, so that the loop
+// bounds and table strides are known to the compiler
+__INLINE
+void fft_r4_kernel(fft_complex_t data[], const fft_complex_t twiddle[], unsigned bits, unsigned stage) {
+  unsigned size = 1 << bits;
+  unsigned q = 1 << stage;            // quarter of the group length
+  unsigned step = size >> (stage + 2); // twiddle table stride for W^k
+  // # Radix-4 DIT trivial butterfly # (k = 0, twiddle factors 1)
+  for(unsigned a = 0; a < size; a += q << 2) {
+    FFT_DECLC(A0, data[a]); FFT_DECLC(A1, data[a + q]);
+    FFT_DECLC(A2, data[a + 2 * q]); FFT_DECLC(A3, data[a + 3 * q]);
+    FFT_DECLR(T0, FFT_A(FFT_D2(FFT(A0,r)), FFT_D2(FFT(A1,r))), FFT_A(FFT_D2(FFT(A0,i)), FFT_D2(FFT(A1,i))));
+    FFT_DECLR(T1, FFT_S(FFT_D2(FFT(A0,r)), FFT_D2(FFT(A1,r))), FFT_S(FFT_D2(FFT(A0,i)), FFT_D2(FFT(A1,i))));
+    FFT_DECLR(T2, FFT_A(FFT_D2(FFT(A2,r)), FFT_D2(FFT(A3,r))), FFT_A(FFT_D2(FFT(A2,i)), FFT_D2(FFT(A3,i))));
+    FFT_DECLR(T3, FFT_S(FFT_D2(FFT(A2,r)), FFT_D2(FFT(A3,r))), FFT_S(FFT_D2(FFT(A2,i)), FFT_D2(FFT(A3,i))));
+    FFT_ASSGN(data[a],         FFT_A(FFT_D2(FFT(T0,r)), FFT_D2(FFT(T2,r))), FFT_A(FFT_D2(FFT(T0,i)), FFT_D2(FFT(T2,i))));
+    FFT_ASSGN(data[a + q],     FFT_A(FFT_D2(FFT(T1,r)), FFT_D2(FFT(T3,i))), FFT_S(FFT_D2(FFT(T1,i)), FFT_D2(FFT(T3,r))));
+    FFT_ASSGN(data[a + 2 * q], FFT_S(FFT_D2(FFT(T0,r)), FFT_D2(FFT(T2,r))), FFT_S(FFT_D2(FFT(T0,i)), FFT_D2(FFT(T2,i))));
+    FFT_ASSGN(data[a + 3 * q], FFT_S(FFT_D2(FFT(T1,r)), FFT_D2(FFT(T3,i))), FFT_A(FFT_D2(FFT(T1,i)), FFT_D2(FFT(T3,r))));
+  }
+  // # Radix-4 DIT butterfly #
+  // With W = W^k of the group length, T0/T1 = A0 +/- W^2.A1 and
+  // T2/T3 = W.A2 +/- W^3.A3; the outputs are T0 + T2, T1 - i.T3, T0 - T2
+  // and T1 + i.T3, divided by 4
+  for(unsigned k = 1; k < q; k++) {
+    FFT_DECLC(W1, twiddle[2 * k * step]);
+    FFT_DECLC(W2, twiddle[k * step]);
+    FFT_DECLC(W3, twiddle[3 * k * step]);
+    for(unsigned a = k; a < size; a += q << 2) {
+      FFT_DECLC(A0, data[a]); FFT_DECLC(A1, data[a + q]);
+      FFT_DECLC(A2, data[a + 2 * q]); FFT_DECLC(A3, data[a + 3 * q]);
+      FFT_DECLR(B1, FFT_R4_MULR(A1, W1), FFT_R4_MULI(A1, W1));
+      FFT_DECLR(B2, FFT_R4_MULR(A2, W2), FFT_R4_MULI(A2, W2));
+      FFT_DECLR(B3, FFT_R4_MULR(A3, W3), FFT_R4_MULI(A3, W3));
+      FFT_DECLR(T0, FFT_A(FFT_D2(FFT(A0,r)), FFT(B1,r)), FFT_A(FFT_D2(FFT(A0,i)), FFT(B1,i)));
+      FFT_DECLR(T1, FFT_S(FFT_D2(FFT(A0,r)), FFT(B1,r)), FFT_S(FFT_D2(FFT(A0,i)), FFT(B1,i)));
+      FFT_DECLR(T2, FFT_A(FFT(B2,r), FFT(B3,r)), FFT_A(FFT(B2,i), FFT(B3,i)));
+      FFT_DECLR(T3, FFT_S(FFT(B2,r), FFT(B3,r)), FFT_S(FFT(B2,i), FFT(B3,i)));
+      FFT_ASSGN(data[a],         FFT_A(FFT_D2(FFT(T0,r)), FFT_D2(FFT(T2,r))), FFT_A(FFT_D2(FFT(T0,i)), FFT_D2(FFT(T2,i))));
+      FFT_ASSGN(data[a + q],     FFT_A(FFT_D2(FFT(T1,r)), FFT_D2(FFT(T3,i))), FFT_S(FFT_D2(FFT(T1,i)), FFT_D2(FFT(T3,r))));
+      FFT_ASSGN(data[a + 2 * q], FFT_S(FFT_D2(FFT(T0,r)), FFT_D2(FFT(T2,r))), FFT_S(FFT_D2(FFT(T0,i)), FFT_D2(FFT(T2,i))));
+      FFT_ASSGN(data[a + 3 * q], FFT_S(FFT_D2(FFT(T1,r)), FFT_D2(FFT(T3,i))), FFT_A(FFT_D2(FFT(T1,i)), FFT_D2(FFT(T3,r))));
+    }
+  }
+}
+
+// Kernels for each supported size
+#define FFT_R4_KERNEL(BITS) \
+void fft_r4_kernel_##BITS(fft_complex_t data[], const fft_complex_t twiddle[], unsigned stage) { \
+  fft_r4_kernel(data, twiddle, BITS, stage); \
+}
+FFT_R4_KERNEL(6)
+FFT_R4_KERNEL(7)
+FFT_R4_KERNEL(8)
+#if FFT_R4_BITS_MAX >= 9
+FFT_R4_KERNEL(9)
+#endif
+#if FFT_R4_BITS_MAX >= 10
+FFT_R4_KERNEL(10)
+#endif
+
+// One stage (0...fft_r4_stages()-1) of the radix-4 forward FFT transform
+// Calling the stages in order is equivalent to fft_forward()
+void fft_r4_stage(const fft_r4_t *plan, fft_complex_t data[], unsigned stage) {
+  unsigned bits = plan->bits;
+  unsigned stage2;
+  if((bits & 1) && stage == 0) {
+    fft_forward_stage(data, bits, 0);
+    return;
+  }
+  // Radix-2 stage number of the first of the pair this stage replaces
+  stage2 = 2 * stage - (bits & 1);
+  switch(bits) {
+  case 6: fft_r4_kernel_6(data, plan->twiddle, stage2); break;
+  case 7: fft_r4_kernel_7(data, plan->twiddle, stage2); break;
+  case 8: fft_r4_kernel_8(data, plan->twiddle, stage2); break;
+#if FFT_R4_BITS_MAX >= 9
+  case 9: fft_r4_kernel_9(data, plan->twiddle, stage2); break;
+#endif
+#if FFT_R4_BITS_MAX >= 10
+  case 10: fft_r4_kernel_10(data, plan->twiddle, stage2); break;
+#endif
+  }
+}
+
+// One stage of the BFP radix-4 forward FFT transform
+// A radix-4 stage can grow the data by up to sqrt(2), so like a radix-2
+// stage it needs 1 bit of headroom
+// Returns the change in block exponent
+int fft_r4_stage_bfp(const fft_r4_t *plan, fft_complex_t data[], unsigned stage) {
+  int exp = 0;
+  unsigned headroom = fft_headroom(data, 1 << plan->bits);
+  if(headroom < 1 || headroom >= FFT_BFP_SLACK)
+    exp = fft_normalise(data, 1 << plan->bits, 1);
+  fft_r4_stage(plan, data, stage);
+  return exp;
+}
+
+#endif//FFT_DIT && FFT_RADIX4
+
 // Inverse FFT transform
 // Permutation must be performed prior to (DIT)/after (DIF) call
 void fft_inverse(fft_complex_t data[], unsigned bits) {
@@ -325,6 +577,39 @@ void fft_fftr(fft_complex_t *complex, unsigned bits) {
   fft_convert(complex, bits, false, false);
 }
 
+// Perform BFP forward FFT (including permutation, real output conversion)
+// Returns the block exponent - data * 2^exponent is the fft_fftr() result
+__INLINE
+int fft_fftr_bfp(fft_complex_t *complex, unsigned bits) {
+  int exp;
+#ifdef FFT_DIT
+  fft_permutate(complex, bits);
+#endif
+  exp = fft_forward_bfp(complex, bits);
+#ifdef FFT_DIF
+  fft_permutate(complex, bits);
+#endif
+  exp += fft_normalise(complex, 1 << bits, FFT_CONVERT_HEADROOM);
+  fft_convert(complex, bits, false, false);
+  return exp;
+}
+
+#if (defined FFT_DIT) && FFT_RADIX4
+// Perform BFP radix-4 forward FFT (including permutation, real output
+// conversion) with the tables in plan
+// Returns the block exponent - data * 2^exponent is the fft_fftr() result
+__INLINE
+int fft_r4_fftr_bfp(const fft_r4_t *plan, fft_complex_t *complex) {
+  int exp = 0;
+  fft_r4_permutate(plan, complex);
+  for(unsigned stage = 0; stage < fft_r4_stages(plan); stage++)
+    exp += fft_r4_stage_bfp(plan, complex, stage);
+  exp += fft_normalise(complex, 1 << plan->bits, FFT_CONVERT_HEADROOM);
+  fft_convert(complex, plan->bits, false, false);
+  return exp;
+}
+#endif
+
 // Perform inverse FFT (including permutation, real input conversion)
 __INLINE
 void fft_ifftr(fft_complex_t *complex, unsigned bits) {
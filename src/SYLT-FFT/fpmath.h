@@ -7,6 +7,9 @@
 #include "config.h"
 #include "intrinsics.h"
 #include "fpmath.h"
+#if !SINE_USE_TABLE
+#include <math.h>
+#endif
 
 #define SINE_SIZE  (1 << SINE_BITS)         // Sine table size
 #define SINE_FBITS (32 - 2 - SINE_BITS)     // Fractional bits
@@ -42,7 +45,7 @@ void sine_init() {
   unsigned int n;
 #if SINE_PRINTOUT
   printf("// ROM\n");
-  printf("#if SINE_BITS != 7\n");
+  printf("#if SINE_BITS != %d\n", SINE_BITS);
   printf("#error \"sinetable[] size does not match SINE_BITS\"\n");
   printf("#endif\n");
   printf("const int32_t sinetable[] = {");
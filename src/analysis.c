@@ -30,19 +30,153 @@
 #include "SYLT-FFT/fft.h"
 
 #include "pebble_sd.h"
+#include "goertzel.h"
+#include "fall_detect.h"
+#include "decimate.h"
+#include "spectrum.h"
 
+// The real FFT of the longest window must fit the sine table - NSAMP_MAX
+// samples are transformed as NSAMP_MAX/2 complex points, and fft_convert()
+// needs up to 2 << SINE_BITS of those.
+#if NSAMP_MAX > (4 << SINE_BITS)
+#error "NSAMP_MAX is too large for SINE_BITS"
+#endif
 
 /* GLOBAL VARIABLES */
 uint32_t num_samples = NSAMP_MAX;
-int32_t accData[NSAMP_MAX];   
+int16_t accData[NSAMP_MAX];   // rolling buffer of acceleration data (milli-g
+                              // - half the memory of 32 bit samples).
+int32_t fftBuf[NSAMP_MAX];    // FFT work space - accData widened to 32 bits,
+                              // in time order.
 fft_complex_t *fftData;   // spectrum calculated by FFT
 short fftResults[NSAMP_MAX/2];  // FFT results
+int fftResultsBuilding = 0; // Flag to say fftResults only holds some of the
+                            // axes of the current window.
+int fftExp = 0;       // block exponent of fftData - fftData x 2^fftExp is
+                      // the fft_fftr() spectrum.
+#if FFT_RADIX4
+fft_r4_t fftR4;       // radix-4 FFT tables for the current window size -
+                      // fftR4.bits is 0 if there is no kernel for the size.
+#endif
+spec_cum_t specCum[NSAMP_MAX/2+1]; // cumulative power - specCum[i] is the
+                                   // sum of the power in bins 1 to i-1.
+struct spec_features specFeatures; // peak, centroid etc. of the spectrum.
+
+// Analysis plan - the bin ranges of the bands that the spectrum is reduced
+// to, and reciprocals of their widths, which only change when the settings
+// or sampling frequency change.   Set up by analysis_plan_build() so that
+// no divisions are needed for each window.  Bin ranges are clamped to the
+// spectrum (bins 1 to nBins-1).
+struct analysis_plan {
+  int nBins;                        // number of spectrum bins (nSamp/2).
+  int nTop;                         // bins calculated in Goertzel mode.
+  int roiMin, roiMax;               // region of interest.
+  struct spec_recip roiRecip;
+  int roiMins[ROI_MAX], roiMaxs[ROI_MAX]; // multi-ROI bands.
+  struct spec_recip roiRecips[ROI_MAX];
+  int specMins[10], specMaxs[10];   // simpleSpec (1 Hz) bands.
+  struct spec_recip specRecips[10];
+};
+struct analysis_plan plan;
 
 int simpleSpec[10];   // simplified spectrum - 0-10 Hz
 
-int accDataPos = 0;   // Position in accData of last point in time series.
-int accDataFull = 0;  // Flag so we know when we have a complete buffer full
-                      // of data.
+int accDataPos = 0;   // Position in accData to write the next sample.
+int accDataFull = 0;  // Flag so we know when a new analysis window is ready.
+int accDataCount = 0; // Number of valid samples in accData (up to nSamp).
+int hopCount = 0;     // Number of samples received since the last analysis.
+int nHop = 0;         // Number of samples between analyses.
+int workBufBusy = 0;  // Flag to say fftBuf holds a window being analysed.
+uint32_t accDataDropped = 0; // Number of samples overwritten in accData
+                      // before they were included in an analysis window.
+AppTimer *analysisTimer = NULL; // Timer used to start the analysis.
+uint32_t accDataFullTime = 0;   // Time (ms) that the latest window was ready.
+uint32_t analysisLatency = 0;   // Time (ms) from window ready to alarm verdict.
+uint32_t analysisLatencyMax = 0; // Longest analysisLatency seen (ms).
+int32_t accSum = 0;   // Sum of the samples in the accData window.
+int64_t accSumSq = 0; // Sum of the squares of the samples in the window.
+int motionGated = 0;  // Flag to say the current window was too still to
+                      // need a spectrum.
+uint32_t fftSkipped = 0; // Number of windows not analysed by motion gate.
+int accelFreq = 0;       // Accelerometer sampling frequency in use (Hz) -
+                         // less than sampleFreq when the adaptive rate
+                         // controller has reduced it.
+int curSampleFreq = 0;   // Sampling frequency of the data in accData (Hz) -
+                         // accelFreq/decimFactor.
+int decimFactor = 1;     // Accelerometer samples per sample in accData.
+struct decimator decimator; // anti-aliasing decimator.
+int specBinsBits = 0;    // specPower is averaged over 2^specBinsBits bins -
+                         // the number of bins at the full sampleFreq.
+int quietTime = 0;       // Time (sec) that ROI power has been below
+                         // adaptiveRate.
+int analysisStep = ANALYSIS_STEP_IDLE; // Next step of the analysis to run.
+int fftStage = 0;     // Next FFT stage (0 = permutation, then butterflies).
+int nFftStages = 0;   // Number of FFT butterfly stages.
+uint32_t analysisBlockMax = 0;  // Longest time (ms) spent in one analysis
+                                // timer callback.
+
+static void analysis_timer_callback(void *data);
+
+#if SDFT_ANALYSIS
+fft_complex_t sdftState[SDFT_NBINS_MAX];  // Sliding DFT bins (un-scaled)
+fft_complex_t sdftTwiddle[SDFT_NBINS_MAX];// r*exp(2*pi*i*k/nSamp) (Q30)
+int32_t sdftRN;       // r^nSamp (Q30) - damping of sample leaving the window
+int nSdftBins = 0;    // Number of sliding DFT bins being calculated.
+#endif
+
+// Goertzel mode (SD_MODE_GOERTZEL) - the window in accData is run through
+// the filters GOERTZEL_STEP_SAMPLES at a time, with the state of the filter
+// for each bin kept in fftData until the whole window has been used.
+int goertzelStart = 0;   // Position in accData of the oldest sample.
+int goertzelPos = 0;     // Number of samples run through the filters.
+int32_t goertzelMean = 0;   // Mean of the window (removed from samples).
+int64_t goertzelEnergy = 0; // Sum of squared deviations from the mean.
+
+#if AXIS_ANALYSIS
+// Per axis analysis (SD_MODE_FFT_AXES) - each axis is transformed in turn
+// in the FFT work space, and the powers are summed to give those of the
+// acceleration vector.  accData holds the x axis data in this mode.
+int16_t accAxes[2][NSAMP_MAX];  // rolling buffers of the y and z data
+                                // (same positions as accData).
+struct decimator axisDecimators[2]; // anti-aliasing decimators for y and z.
+int32_t axisSum[2];   // Sums of the y and z samples in the window.
+int64_t axisSumSq[2]; // Sums of the squares of the y and z samples.
+// While the axes are being analysed the y and z windows are left as they
+// were when the window was handed over, and new y and z samples wait in
+// axisPending.
+int16_t axisPending[AXIS_PENDING_MAX][2];
+int axisPendingCount = 0; // Number of samples in axisPending.
+int axisFrozen = 0;   // Flag to say the y and z windows are being analysed.
+int axisWindowPos = 0; // accDataPos when the window was handed over.
+int fftAxis = 0;      // Axis being analysed.
+// Sums of the axis results so far, and the features of the axis with the
+// most ROI power.
+struct axis_sums {
+  uint64_t specPower, roiPower;
+  uint64_t roiPowers[ROI_MAX];
+  uint64_t simpleSpec[10];
+  long bestRoiPower;
+  struct spec_features features;
+};
+struct axis_sums axisSums;
+#endif
+
+struct fall_detector fallDetector;  // streaming fall detector.
+
+#if FILTER_ANALYSIS
+// Second order IIR (biquad) filter section - Direct Form I.
+struct biquad {
+  int32_t b0, b1, b2, a1, a2;   // coefficients (FILTER_COEFF_BITS)
+  int32_t x1, x2, y1, y2;       // previous inputs and outputs
+};
+struct biquad roiFilter[2*FILTER_ORDER]; // ROI band pass (high pass
+                                         // sections then low pass sections)
+struct biquad specFilter[2*FILTER_ORDER];// whole spectrum band pass.
+int32_t roiFilterPower;         // Leaky integrators of filter output power
+int32_t specFilterPower;
+int filterIntBits;              // integrator time constant is 2^filterIntBits
+                                // samples.
+#endif
 
 
 /*************************************************************
@@ -50,18 +184,70 @@ int accDataFull = 0;  // Flag so we know when we have a complete buffer full
  *************************************************************/
 
 /*********************************************
- * Returns the magnitude of a complex number
- * (well, actually magnitude^2 to save having to do
- * a square root.
+ * Returns the current time in milliseconds (wraps after ~49 days, so
+ * only differences between times are meaningful).
+ */
+static uint32_t get_time_ms() {
+  time_t s;
+  uint16_t ms;
+  time_ms(&s,&ms);
+  return (uint32_t)s*1000 + ms;
+}
+
+/*********************************************
+ * Returns power limited to the largest value a long can hold.
+ */
+static long clamp_power(uint64_t power) {
+  return (power>0x7fffffff) ? 0x7fffffff : (long)power;
+}
+
+/*********************************************
+ * Returns acceleration x limited to the range of the int16_t sample buffers.
+ * The accelerometer reads at most +/-4g per axis (a magnitude sum of 12000
+ * milli-g) so this is only a safeguard against the value wrapping around.
+ */
+static int16_t sample16(int32_t x) {
+  if (x>INT16_MAX) return INT16_MAX;
+  if (x<INT16_MIN) return INT16_MIN;
+  return (int16_t)x;
+}
+
+/*********************************************
+ * Returns the spectrum power of a window whose sum of squared deviations
+ * from the mean is energy, from Parseval's theorem - sum of |X_k|^2 for
+ * k=1..nSamp/2-1 is (nSamp/2)*energy.  fft_fftr() returns 4/nSamp x X_k,
+ * and specPower is averaged over 2^specBinsBits bins, so
+ * specPower = 8*energy/(nSamp*2^specBinsBits).
  */
-int getMagnitude(fft_complex_t c) {
-  int mag;
-  mag = c.r*c.r + c.i*c.i;
-  return mag;
+static long energy_power(int64_t energy) {
+  if (energy<=0) return 0;
+  return clamp_power((uint64_t)(8*energy) >> (fftBits+1+specBinsBits));
 }
 
-int getAmpl(int nBin) {
-  return fftData[nBin].r;
+/*********************************************
+ * Returns the sum of squared deviations from the mean of the window in
+ * accData, from the running sums kept by accel_handler().
+ */
+static int64_t window_energy() {
+  return accSumSq - (((int64_t)accSum*accSum) >> (fftBits+1));
+}
+
+/*********************************************
+ * Returns the average power per bin in bins binMin to binMax-1, using the
+ * cumulative power array calculated by analysis_reduce() - recip is the
+ * reciprocal of the number of bins, from the analysis plan.
+ */
+static long band_power(int binMin, int binMax, const struct spec_recip *recip) {
+  return clamp_power(spec_recip_div64(specCum[binMax] - specCum[binMin],recip));
+}
+
+/*********************************************
+ * Returns 10 x the ratio of power to specPower (0 if there is no power in
+ * the spectrum).
+ */
+static int power_ratio(long power) {
+  if (specPower<=0) return 0;
+  return (int)(10*(int64_t)power/specPower);
 }
 
 
@@ -78,24 +264,26 @@ int alarm_check() {
 
   inAlarm = false;
   alarmRoi = 0;
-  if (sdMode == SD_MODE_FFT) {
-    inAlarm = (roiPower>alarmThresh) && (roiRatio>alarmRatioThresh);
-  }
-  // Check each of the multiple ROIs - any one being in alarm state is an alarm.
-  else if (sdMode == SD_MODE_FFT_MULTI_ROI) {
-    if (roiPower>alarmThresh) {
-      for (i=0;i<=3;i++) {
-	if (roiRatios[i]>alarmRatioThresh) {
-	  inAlarm = true;
-	  alarmRoi = i;
-	  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"doAnalysis() - alarm in ROI %d", alarmRoi);
-	}
+  // Check each of the multiple ROIs - any one being in alarm state is an
+  // alarm.  Each ROI must have enough power of its own, so a strong signal
+  // in one band cannot let a high ratio in a weak band raise an alarm.
+  if (sdMode == SD_MODE_FFT_MULTI_ROI) {
+    for (i=0;i<nRoiBands;i++) {
+      if ((roiPowers[i]>alarmThresh) && (roiRatios[i]>alarmRatioThresh)) {
+	inAlarm = true;
+	alarmRoi = i;
+	if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"doAnalysis() - alarm in ROI %d", alarmRoi);
       }
     }
   }
+  // All the other analysis modes use a single ROI.
+  else {
+    inAlarm = (roiPower>alarmThresh) && (roiRatio>alarmRatioThresh);
+  }
   
   if (inAlarm) {
-    alarmCount+=samplePeriod;
+    // each analysis covers analysisPeriod seconds of new data.
+    alarmCount+=analysisPeriod;
     if (alarmCount>alarmTime) {
       alarmState = 2;
     } else if (alarmCount>warnTime) {
@@ -117,10 +305,330 @@ int alarm_check() {
 }
 
 
+#if SDFT_ANALYSIS
+/**
+ * sdft_init():  Calculate the twiddle factors for the sliding DFT and
+ * zero its bins.   Bins 0 to nFreqCutoff are calculated, up to a maximum
+ * of SDFT_NBINS_MAX.
+ * A damping factor r slightly less than 1 is applied so that rounding
+ * errors decay rather than accumulating.
+ */
+static void sdft_init() {
+  int k;
+  int32_t r = (1<<30) - (1<<(30-SDFT_DAMPING_BITS));   // r in Q30
+
+  nSdftBins = (int)(1000*freqCutoff/freqRes) + 1;
+  if (nSdftBins>SDFT_NBINS_MAX) nSdftBins = SDFT_NBINS_MAX;
+  if (nSdftBins>nSamp/2) nSdftBins = nSamp/2;
+
+  // r^nSamp by repeated squaring (nSamp is a power of 2)
+  sdftRN = r;
+  for (k=0;k<=fftBits;k++)
+    sdftRN = (int32_t)(((int64_t)sdftRN*sdftRN + (1<<29))>>30);
+
+  for (k=0;k<nSdftBins;k++) {
+    // angle as a fraction of 2^32 - sine() and cosine() return Q31.
+    uint32_t pos = (uint32_t)k << (32-fftBits-1);
+    int32_t c = cosine(pos)>>1;
+    int32_t s = sine(pos)>>1;
+    sdftTwiddle[k].r = (int32_t)(((int64_t)c*r + (1<<29))>>30);
+    sdftTwiddle[k].i = (int32_t)(((int64_t)s*r + (1<<29))>>30);
+    sdftState[k].r = 0;
+    sdftState[k].i = 0;
+  }
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"sdft_init(): nSdftBins=%d, sdftRN=%ld",
+		     nSdftBins,(long)sdftRN);
+}
+
+/**
+ * sdft_update():  Update the sliding DFT bins with a new sample xNew,
+ * which replaces sample xOld (taken nSamp samples ago) in the window.
+ */
+static void sdft_update(int32_t xNew, int32_t xOld) {
+  int k;
+  int32_t d = xNew - (int32_t)(((int64_t)xOld*sdftRN + (1<<29))>>30);
+  for (k=0;k<nSdftBins;k++) {
+    int64_t ar = sdftState[k].r + d;
+    int64_t ai = sdftState[k].i;
+    sdftState[k].r = (int32_t)((ar*sdftTwiddle[k].r - ai*sdftTwiddle[k].i
+				+ (1<<29))>>30);
+    sdftState[k].i = (int32_t)((ar*sdftTwiddle[k].i + ai*sdftTwiddle[k].r
+				+ (1<<29))>>30);
+  }
+}
+
+/**
+ * sdft_get_spectrum():  Copy the sliding DFT bins into fftData, scaled to
+ * match the output of fft_fftr() (which is 4/nSamp x the DFT).
+ */
+static void sdft_get_spectrum() {
+  int i;
+  int shift = fftBits - 1;  // nSamp/4 = 2^(fftBits-1)
+  for (i=0;i<nSamp/2;i++) {
+    if (i<nSdftBins) {
+      fftData[i].r = sdftState[i].r >> shift;
+      fftData[i].i = sdftState[i].i >> shift;
+    } else {
+      fftData[i].r = 0;
+      fftData[i].i = 0;
+    }
+  }
+}
+#else
+// Sliding DFT mode is not built (see pebble_sd.h).
+static void sdft_init() {}
+static void sdft_update(int32_t xNew, int32_t xOld) {}
+static void sdft_get_spectrum() {}
+#endif
+
+/**
+ * goertzel_start():  Start running the window in accData through the
+ * Goertzel filters for the bins used by the alarm check and the simplified
+ * spectrum (bins 1 to plan.nTop-1).   The other bins in fftData are zeroed.
+ * The mean and energy come from the running sums, so specPower is found
+ * from the energy (Parseval's theorem) rather than by calculating every bin.
+ */
+static void goertzel_start() {
+  int i;
+  goertzelStart = accDataPos;
+  goertzelPos = 0;
+  goertzelMean = accSum/nSamp;
+  goertzelEnergy = window_energy();
+  for (i=0;i<nSamp/2;i++) {
+    fftData[i].r = 0;
+    fftData[i].i = 0;
+  }
+}
+
+/**
+ * goertzel_step():  Run the next GOERTZEL_STEP_SAMPLES samples of the
+ * window through the filters, and once the whole window has been used
+ * convert the filter states in fftData to bins scaled to match fft_fftr()
+ * output.  Returns 1 when the spectrum is complete.
+ * Each bin costs a multiply per sample, so the cost is nSamp x (plan.nTop-1)
+ * multiplies per window.
+ * New samples overwrite the oldest ones in accData, which is why they are
+ * used first - if samples arrive faster than the filters use them, some of
+ * the window is replaced by newer samples and a warning is logged.
+ */
+static int goertzel_step() {
+  int i, n;
+  int32_t re, im;
+  n = nSamp - goertzelPos;
+  if (n>GOERTZEL_STEP_SAMPLES) n = GOERTZEL_STEP_SAMPLES;
+  if (hopCount>goertzelPos)
+    APP_LOG(APP_LOG_LEVEL_WARNING,"goertzel_step() - %d samples overwritten",
+	    hopCount-goertzelPos);
+  for (i=1;i<plan.nTop;i++) {
+    // angle as a fraction of 2^32 - sine() and cosine() return Q31.
+    uint32_t pos = (uint32_t)i << (32-fftBits-1);
+    goertzel_run(accData,nSamp,(goertzelStart+goertzelPos)%nSamp,n,
+		 goertzelMean,cosine(pos)>>1,&fftData[i].r,&fftData[i].i);
+  }
+  goertzelPos += n;
+  if (goertzelPos<nSamp) return 0;
+
+  for (i=1;i<plan.nTop;i++) {
+    uint32_t pos = (uint32_t)i << (32-fftBits-1);
+    goertzel_result(fftData[i].r,fftData[i].i,cosine(pos)>>1,sine(pos)>>1,
+		    &re,&im);
+    fftData[i].r = re >> (fftBits-1);
+    fftData[i].i = im >> (fftBits-1);
+  }
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"goertzel_step(): nTop=%d, mean=%ld",
+		     plan.nTop,(long)goertzelMean);
+  return 1;
+}
+
+#if FILTER_ANALYSIS
+/**
+ * biquad_init():  Set the coefficients of filter section f to a second order
+ * Butterworth low pass (highPass=0) or high pass (highPass=1) filter with
+ * cut-off frequency freq (mHz), using the 'audio EQ cookbook' formulae.
+ */
+static void biquad_init(struct biquad *f, int freq, int highPass) {
+  int32_t c, alpha;
+  int64_t a0;
+  // w0 as a fraction of 2^32 - sine() and cosine() return Q31.
+  uint32_t pos = (uint32_t)(((uint64_t)freq<<32)/(1000*curSampleFreq));
+  c = cosine(pos);
+  alpha = FFT_M(sine(pos),1518500250) << 1;   // sin(w0)/(2Q), Q=1/sqrt(2)
+  a0 = (int64_t)0x80000000 + alpha;
+  // Coefficients are Q31 values scaled by 1/a0, then reduced to
+  // FILTER_COEFF_BITS fractional bits.
+#define BIQUAD_COEFF(V) (int32_t)(((int64_t)(V) << FILTER_COEFF_BITS)/a0)
+  if (highPass) {
+    f->b0 = BIQUAD_COEFF(((int64_t)0x80000000 + c)/2);
+    f->b1 = -2*f->b0;
+  } else {
+    f->b0 = BIQUAD_COEFF(((int64_t)0x80000000 - c)/2);
+    f->b1 = 2*f->b0;
+  }
+  f->b2 = f->b0;
+  f->a1 = BIQUAD_COEFF(-2*(int64_t)c);
+  f->a2 = BIQUAD_COEFF((int64_t)0x80000000 - alpha);
+#undef BIQUAD_COEFF
+  f->x1 = f->x2 = f->y1 = f->y2 = 0;
+}
+
+/**
+ * biquad_filter():  Pass sample x through filter section f, returning the
+ * filter output.
+ */
+static int32_t biquad_filter(struct biquad *f, int32_t x) {
+  int64_t acc;
+  int32_t y;
+  acc = (int64_t)f->b0*x + (int64_t)f->b1*f->x1 + (int64_t)f->b2*f->x2
+    - (int64_t)f->a1*f->y1 - (int64_t)f->a2*f->y2;
+  y = (int32_t)((acc + (1<<(FILTER_COEFF_BITS-1))) >> FILTER_COEFF_BITS);
+  f->x2 = f->x1;
+  f->x1 = x;
+  f->y2 = f->y1;
+  f->y1 = y;
+  return y;
+}
+
+/**
+ * filter_init():  Initialise the filters used by SD_MODE_FILTER - a band pass
+ * filter for the region of interest and one for the whole spectrum (up
+ * to freqCutoff), each made from FILTER_ORDER high pass and FILTER_ORDER
+ * low pass sections.
+ */
+static void filter_init() {
+  int i;
+  int fMax = 1000*freqCutoff;
+  // Keep the low pass filters below the Nyquist frequency.
+  if (fMax>450*curSampleFreq) fMax = 450*curSampleFreq;
+  for (i=0;i<FILTER_ORDER;i++) {
+    biquad_init(&roiFilter[i],1000*alarmFreqMin,1);
+    biquad_init(&roiFilter[FILTER_ORDER+i],1000*alarmFreqMax,0);
+    biquad_init(&specFilter[i],FILTER_FREQ_MIN,1);
+    biquad_init(&specFilter[FILTER_ORDER+i],fMax,0);
+  }
+  roiFilterPower = 0;
+  specFilterPower = 0;
+  // integrator time constant as a power of 2 number of samples.
+  for (filterIntBits=0;
+       (2<<filterIntBits)*1000<=FILTER_TIME_CONST*curSampleFreq;
+       filterIntBits++);
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"filter_init(): filterIntBits=%d",
+		     filterIntBits);
+}
+
+/**
+ * filter_update():  Pass a new sample through the filters and update the
+ * leaky integrators of the power in the ROI and whole spectrum.
+ */
+static void filter_update(int32_t acc) {
+  int i;
+  int32_t x = acc << FILTER_FRAC_BITS;
+  int32_t yRoi = x, ySpec = x;
+  for (i=0;i<2*FILTER_ORDER;i++) {
+    yRoi = biquad_filter(&roiFilter[i],yRoi);
+    ySpec = biquad_filter(&specFilter[i],ySpec);
+  }
+  yRoi = yRoi >> FILTER_FRAC_BITS;
+  ySpec = ySpec >> FILTER_FRAC_BITS;
+  roiFilterPower += (yRoi*yRoi - roiFilterPower) >> filterIntBits;
+  specFilterPower += (ySpec*ySpec - specFilterPower) >> filterIntBits;
+}
+
+/**
+ * filter_get_power():  Set roiPower and specPower from the filter output
+ * power, scaled to match the FFT analysis.
+ * Summing fft_fftr() output over the bins in a band gives 8 x the mean
+ * square of the signal in that band, and roiPower and specPower are
+ * averages per bin.
+ */
+static void filter_get_power() {
+  roiPower = (long)spec_recip_div(8*(uint32_t)roiFilterPower,&plan.roiRecip);
+  specPower = (8*(long)specFilterPower) >> specBinsBits;
+  if (specPower>0)
+    roiRatio = 10 * roiPower/specPower;
+  else
+    roiRatio = 0;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"filter_get_power(): roiPower=%ld, specPower=%ld",
+		     roiPower,specPower);
+}
+#else
+// Filter mode is not built (see pebble_sd.h).
+static void filter_init() {}
+static void filter_update(int32_t acc) {}
+static void filter_get_power() {}
+#endif
+
+#if AXIS_ANALYSIS
+/****************************************************************
+ * axis_store():  Store y and z axis samples at position pos of accAxes,
+ * keeping the motion gate sums up to date.
+ */
+static void axis_store(int pos, int16_t y, int16_t z) {
+  int16_t v[2] = { y, z };
+  int k;
+  for (k=0;k<2;k++) {
+    axisSum[k] += v[k] - accAxes[k][pos];
+    axisSumSq[k] += (int64_t)v[k]*v[k]
+      - (int64_t)accAxes[k][pos]*accAxes[k][pos];
+    accAxes[k][pos] = v[k];
+  }
+}
+
+/****************************************************************
+ * axis_flush():  Move the samples waiting in axisPending into accAxes, at
+ * the positions they would have had if they had been stored on arrival.
+ */
+static void axis_flush() {
+  int pos = axisWindowPos;
+  int i;
+  for (i=0;i<axisPendingCount;i++) {
+    axis_store(pos,axisPending[i][0],axisPending[i][1]);
+    pos++;
+    if (pos>=nSamp) pos = 0;
+  }
+  axisPendingCount = 0;
+}
+
+/****************************************************************
+ * axis_add():  Add the latest y and z samples, which go with the x sample
+ * at accData[accDataPos].  While the axes of a window are being analysed
+ * they wait in axisPending.  If the analysis takes too long for
+ * axisPending the y and z windows are let go, so those not yet copied to
+ * the work space end later than the x one.
+ */
+static void axis_add(int16_t y, int16_t z) {
+  if (axisFrozen) {
+    if (axisPendingCount<AXIS_PENDING_MAX) {
+      axisPending[axisPendingCount][0] = y;
+      axisPending[axisPendingCount][1] = z;
+      axisPendingCount++;
+      return;
+    }
+    APP_LOG(APP_LOG_LEVEL_WARNING,"axis_add() - analysis too slow, axis windows not aligned");
+    axis_flush();
+    axisFrozen = 0;
+  }
+  axis_store(accDataPos,y,z);
+}
+
+/****************************************************************
+ * axis_release():  Called when the axes of a window have been analysed -
+ * brings the y and z buffers up to date and sends the spectrum if it was
+ * asked for while it was being built.
+ */
+static void axis_release() {
+  axis_flush();
+  axisFrozen = 0;
+  fftResultsBuilding = 0;
+  if (fftSpecDeferred) sendFftSpec();
+}
+#endif
+
 /**
  * accel_handler():  Called whenever accelerometer data is available.
  * Add data to circular buffer accData[] and increments accDataPos to show
- * the position of the latest data in the buffer.
+ * the position of the next data point in the buffer.
+ * Sets accDataFull once the buffer holds a full window and nHop new samples
+ * have arrived since the last analysis.
  */
 void accel_handler(AccelData *data, uint32_t num_samples) {
   int i;
@@ -131,194 +639,511 @@ void accel_handler(AccelData *data, uint32_t num_samples) {
   } else {
     // Add the new data to the accData buffer
     for (i=0;i<(int)num_samples;i++) {
-      // Wrap around the buffer if necessary
-      if (accDataPos>=nSamp) { 
-	accDataPos = 0;
-	accDataFull = 1;
-	break;
-      }
       // Ignore any data when the vibrator motor was running.
       // FIXME - this doesn't seem to work - alarm latches on if the 
       //         vibrator operates.
       if (!data[i].did_vibrate) {
+	int32_t acc = abs(data[i].x) + abs(data[i].y) + abs(data[i].z);
+#if AXIS_ANALYSIS
+	int32_t axes[3] = { data[i].x, data[i].y, data[i].z };
+	int k;
+#endif
+	// Fall detection is done as each sample arrives, at the full
+	// accelerometer rate - fallDetected is cleared once the fall has been
+	// reported.
+	if (fallActive && fall_update(&fallDetector,acc)) {
+	  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"accel_handler() - ****FALL DETECTED****");
+	  fallDetected = 1;
+	}
+	// Reduce the data to curSampleFreq before it is buffered.  The axis
+	// decimators have the same factor, so they output the same samples.
+	// accData holds the x axis in the per axis mode.
+#if AXIS_ANALYSIS
+	if (sdMode==SD_MODE_FFT_AXES) {
+	  acc = axes[0];
+	  for (k=0;k<2;k++) decim_push(&axisDecimators[k],axes[k+1],&axes[k+1]);
+	}
+#endif
+	if (!decim_push(&decimator,acc,&acc)) continue;
+	acc = sample16(acc);
+	// accData[accDataPos] is the sample leaving the window (or zero if
+	// the buffer is not yet full).
+	if (sdMode==SD_MODE_SDFT) sdft_update(acc,accData[accDataPos]);
+	else if (sdMode==SD_MODE_FILTER) filter_update(acc);
+	// Keep the sums used by the motion gate up to date.
+	accSum += acc - accData[accDataPos];
+	accSumSq += (int64_t)acc*acc
+	  - (int64_t)accData[accDataPos]*accData[accDataPos];
 	// add good data to the accData array
-	accData[accDataPos] = abs(data[i].x) + abs(data[i].y) + abs(data[i].z);
+	accData[accDataPos] = acc;
+#if AXIS_ANALYSIS
+	if (sdMode==SD_MODE_FFT_AXES)
+	  axis_add(sample16(axes[1]),sample16(axes[2]));
+#endif
 	accDataPos++;
+	// Wrap around the buffer if necessary
+	if (accDataPos>=nSamp) accDataPos = 0;
+	if (accDataCount<nSamp) accDataCount++;
+	hopCount++;
       }
     }
+    // The filter mode does not need a full buffer - its output is
+    // continuously available.
+    // If the previous window is still being analysed we keep collecting
+    // data and hand over a window when the analysis has finished.
+    // The analysis is started straight away from a timer callback rather
+    // than waiting for the next clock tick.
+    if (((accDataCount>=nSamp) || (sdMode==SD_MODE_FILTER))
+	&& (hopCount>=nHop) && !workBufBusy && !accDataFull) {
+      accDataFull = 1;
+      accDataFullTime = get_time_ms();
+      if (analysisTimer==NULL)
+	analysisTimer = app_timer_register(0,analysis_timer_callback,NULL);
+    }
     latestAccelData = data[num_samples-1];
   }
 }
 
 /****************************************************************
- * Simple threshold analysis to chech for fall.
- * Called from clock_tick_handler()
+ * window_copy():  Copy the window of data in the rolling buffer buf (accData
+ * or one of accAxes) that starts at pos into the FFT work space, oldest
+ * sample first, widening the samples to 32 bits for the fixed point FFT.
  */
-void check_fall() {
-  int i,j;
-  int minAcc, maxAcc;
+static void window_copy(const int16_t *buf, int pos) {
+  int n = nSamp - pos;
+  int i;
+  for (i=0;i<n;i++) fftBuf[i] = buf[pos+i];
+  for (i=0;i<pos;i++) fftBuf[n+i] = buf[i];
+}
 
-  int fallWindowSamp = (fallWindow*sampleFreq)/1000; // Convert ms to samples.
-  APP_LOG(APP_LOG_LEVEL_DEBUG,"check_fall() - fallWindowSamp=%d",
-	  fallWindowSamp);
-  // Move window through sample buffer, checking for fall.
-  fallDetected = 0;
-  for (i=0;i<nSamp-fallWindowSamp;i++) {  // i = window start point
-    // Find max and min acceleration within window.
-    minAcc = accData[i];
-    maxAcc = accData[i];
-    for (j=0;j<fallWindowSamp;j++) {  // j = position within window
-      if (accData[i+j]<minAcc) minAcc = accData[i+j];
-      if (accData[i+j]>maxAcc) maxAcc = accData[i+j];
-    }
-    if ((minAcc<fallThreshMin) && (maxAcc>fallThreshMax)) {
-      if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"check_fall() - minAcc=%d, maxAcc=%d",
-	      minAcc,maxAcc);
-      if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"check_fall() - ****FALL DETECTED****");
-      fallDetected = 1;
-      return;
-    }
+/****************************************************************
+ * analysis_handoff():  Hand the latest window of data over from the
+ * acquisition buffer (accData) to the analysis work space (fftBuf).
+ * accel_handler() only ever writes to accData, so data keeps being collected
+ * while the work space is being analysed, and the next window is not handed
+ * over until workBufBusy is cleared at the end of the analysis.
+ * Any samples that were overwritten in accData before being handed over
+ * are counted in accDataDropped.
+ */
+static void analysis_handoff() {
+  if (hopCount>nSamp) {
+    accDataDropped += hopCount - nSamp;
+    APP_LOG(APP_LOG_LEVEL_WARNING,"analysis_handoff() - %d samples dropped, total=%lu",
+	    hopCount-nSamp,(unsigned long)accDataDropped);
   }
-  //if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"check_fall() - minAcc=%d, maxAcc=%d",
-  //	  minAcc,maxAcc);
+  hopCount = 0;
+  accDataFull = 0;
+  workBufBusy = 1;
 
-}
+  // The sliding DFT, Goertzel and filter modes do not use the work space
+  // for the window - they read their own state or accData.
+  if ((sdMode==SD_MODE_SDFT) || (sdMode==SD_MODE_GOERTZEL)
+      || (sdMode==SD_MODE_FILTER))
+    return;
 
+#if AXIS_ANALYSIS
+  // The axes are analysed one at a time, starting with x.  There is only
+  // room in the work space for one axis, so the y and z windows are held
+  // in accAxes until their turn comes (see axis_add()), and end at the
+  // same sample as the x window.
+  if (sdMode==SD_MODE_FFT_AXES) {
+    fftAxis = 0;
+    axisWindowPos = accDataPos;
+    axisFrozen = 1;
+  }
+#endif
+
+  // Copy the rolling buffer into the FFT work space, so that accData is
+  // left intact for the next (overlapping) window.
+  window_copy(accData,accDataPos);
+}
 
 /****************************************************************
- * Carry out analysis of acceleration time series to check for seizures
- * Called from clock_tick_handler().
+ * motion_gate():  Returns 1 if the window of data in accData has too little
+ * movement to be worth calculating the spectrum.
+ * The spectrum power is calculated from the time domain energy (variance) of
+ * the window using Parseval's theorem (see energy_power()).
+ * A window is only gated if its power is below motionFloor and even if it
+ * were all within the region of interest roiPower could not exceed
+ * alarmThresh, so gating can never hide an alarm.
+ * If the window is gated, the spectrum is assumed to be flat, so roiPower
+ * and the simplified spectrum are set to specPower, and the displayed
+ * spectrum (fftResults) is cleared rather than left from an earlier window.
  */
-void do_analysis() {
-  int i,n;
-  APP_LOG(APP_LOG_LEVEL_DEBUG,"do_analysis");
-  // Calculate the frequency resolution of the output spectrum.
-  // Stored as an integer which is 1000 x the frequency resolution in Hz.
-
-  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"do_analysis");
-  freqRes = (int)(1000*sampleFreq/nSamp);
-  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"T=%d ms, freqRes=%d Hz/(1000 bins)",
-		     1000*nSamp/sampleFreq,freqRes);
-  // Set the frequency bounds for the analysis in fft output bin numbers.
-  nMin = (int)(1000*alarmFreqMin/freqRes);
-  nMax = (int)(1000*alarmFreqMax/freqRes);
+static int motion_gate() {
+  int64_t energy;
+  long power;
+  int i;
 
-  // Set frequency bounds for multi-ROI mode
-  // ROI 0 is the whole ROI
-  nMins[0] = nMin;
-  nMaxs[0] = nMax;
+  if ((motionFloor<=0) || (sdMode==SD_MODE_FILTER)) return 0;
+  energy = window_energy();
+#if AXIS_ANALYSIS
+  // The power of the acceleration vector is the sum of the axis powers.
+  if (sdMode==SD_MODE_FFT_AXES)
+    for (i=0;i<2;i++)
+      energy += axisSumSq[i]
+	- (((int64_t)axisSum[i]*axisSum[i]) >> (fftBits+1));
+#endif
+  power = energy_power(energy);
+  if (power>=motionFloor) return 0;
+  // The total power is specPower x 2^specBinsBits, so roiPower can be at
+  // most that divided by the width of the ROI.
+  if (((int64_t)power << specBinsBits)
+      > (int64_t)alarmThresh*(plan.roiMax-plan.roiMin)) return 0;
 
-  // ROI 1 is the lower half
-  nMins[1] = nMin;
-  nMaxs[1] = (nMin+nMax)/2;
+  specPower = power;
+  roiPower = power;
+  roiRatio = 10;
+  for (i=0;i<nRoiBands;i++) {
+    roiPowers[i] = power;
+    roiRatios[i] = 10;
+  }
+  for (i=0;i<10;i++)
+    simpleSpec[i] = power;
+  // The share of each axis is not known.
+  for (i=0;i<3;i++) {
+    axisRoiPowers[i] = 0;
+    axisSpecPowers[i] = 0;
+  }
+  // A flat spectrum has no peak.
+  maxVal = (int)power;
+  maxLoc = 0;
+  maxFreq = 0;
+  peakFreq = 0;
+  specCentroid = 0;
+  roiPeakRatio = 10;
+  // Leave the spectrum alone while it is being sent to the phone.
+  if (!fftSpecBusy) memset(fftResults,0,sizeof(fftResults));
+  fftSkipped++;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"motion_gate(): specPower=%ld - skipped %lu windows",
+		     power,(unsigned long)fftSkipped);
+  return 1;
+}
 
-  // ROI 2 is the upper half
-  nMins[2] = (nMin+nMax)/2;
-  nMaxs[2] = nMax;
+/****************************************************************
+ * analysis_start():  First step of the analysis of a window of data.
+ * Takes the window of data to analyse and, for the modes that do not need
+ * an FFT, collects the spectrum.
+ * Sets motionGated if the window is too still to need a spectrum.
+ */
+static void analysis_start() {
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"analysis_start()");
 
-  // ROI 3 is the middle half
-  nMins[3] = nMin + (nMax-nMin)/4;
-  nMaxs[3] = nMax - (nMax-nMin)/4;
-  
-  // Calculate the bin number of the cutoff frequency
-  nFreqCutoff = (int)(1000*freqCutoff/freqRes);  
+  // If the wearer is still there is no need to calculate the spectrum.
+  motionGated = motion_gate();
 
-  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"do_analysis():  nMin=%d, nMax=%d, nFreqCutoff=%d, fftBits=%d, nSamp=%d",
-		     nMin,nMax,nFreqCutoff,fftBits,nSamp);
+  /* Take the window to analyse - the next one is collected while we work */
+  analysis_handoff();
 
-  if (debug) for (i=0;i<=3;i++) {
-      APP_LOG(APP_LOG_LEVEL_DEBUG,"do_analysis(): nMins[%d]=%d, nMaxs[%d]=%d",
-	      i,nMins[i],i,nMaxs[i]);
-    }
+  if (motionGated) {
+    workBufBusy = 0;
+#if AXIS_ANALYSIS
+    axis_release();
+#endif
+    return;
+  }
 
-  // Do the FFT conversion from time to frequency domain.
-  // The output is stored in accData.  fftData is a pointer to accData.
-  fft_fftr((fft_complex_t *)accData,fftBits);
+  // The filters are updated by accel_handler(), so we just collect the
+  // output power - there is no spectrum in this mode.
+  if (sdMode==SD_MODE_FILTER) {
+    filter_get_power();
+    workBufBusy = 0;
+  } else if (sdMode==SD_MODE_SDFT) {
+    // The sliding DFT is kept up to date by accel_handler() so we just
+    // need to collect the result.
+    sdft_get_spectrum();
+    fftExp = 0;
+  } else if (sdMode==SD_MODE_GOERTZEL) {
+    // Started here because the window starts at the current accDataPos.
+    goertzel_start();
+    fftExp = 0;
+  }
+}
 
+/****************************************************************
+ * set_features():  Set the peak and centroid frequencies (mHz) and ROI peak
+ * ratio sent to the phone from the spectrum features f.
+ */
+static void set_features(const struct spec_features *f) {
+  // freqRes is 1000 x Hz per bin.
+  maxVal = (int)clamp_power(f->peakPower);
+  maxLoc = f->peakBin;
+  peakFreq = (f->peakPos*freqRes) >> SPEC_FRAC_BITS;
+  maxFreq = (peakFreq+500)/1000;
+  specCentroid = (f->centroid*freqRes) >> SPEC_FRAC_BITS;
+  roiPeakRatio = f->roiPeakRatio;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"peak bin %d, peakFreq=%d mHz, centroid=%d mHz, roiPeakRatio=%d",
+		     maxLoc,peakFreq,specCentroid,roiPeakRatio);
+}
 
-  // Ignore position zero though (DC component)
-  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"Calculating specPower - nSamp=%d",nSamp);
-  specPower = 0;
-  for (i=1;i<nSamp/2;i++) {
-    // Find absolute value of the imaginary fft output.
-    if (i<=nFreqCutoff) {
-      specPower = specPower + getMagnitude(fftData[i]);
-    } else {
-      //if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"i = %d, zeroing data above cutoff frequency",i);
-      fftData[i].r = 0;
+#if AXIS_ANALYSIS
+/****************************************************************
+ * axis_accumulate():  Add the powers of the axis that has just been
+ * reduced (fftAxis) to axisSums, and keep its features if it has the most
+ * ROI power so far.
+ */
+static void axis_accumulate() {
+  int i;
+  if (fftAxis==0) {
+    memset(&axisSums,0,sizeof(axisSums));
+    axisSums.bestRoiPower = -1;
+    // analysis_reduce() has put the x axis spectrum in fftResults, unless
+    // it is being sent to the phone.
+    fftResultsBuilding = !fftSpecBusy;
+  } else if (fftResultsBuilding) {
+    for (i=1;i<plan.nBins;i++) {
+      spec_cum_t p = specCum[i+1] - specCum[i];
+      int32_t sum = fftResults[i] + ((p>32767) ? 32767 : (int32_t)p);
+      fftResults[i] = (sum>32767) ? 32767 : (short)sum;
     }
-    // fftResults is used by UI to display spectrum.
-    fftResults[i] = getMagnitude(fftData[i]);
   }
-  // specPower is average power per bin for whole spectrum.
-  specPower = specPower/(nSamp/2);
-  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"specPower=%ld",specPower);
+  axisRoiPowers[fftAxis] = roiPower;
+  axisSpecPowers[fftAxis] = specPower;
+  axisSums.specPower += specPower;
+  axisSums.roiPower += roiPower;
+  for (i=0;i<nRoiBands;i++) axisSums.roiPowers[i] += roiPowers[i];
+  for (i=0;i<10;i++) axisSums.simpleSpec[i] += simpleSpec[i];
+  if (roiPower>axisSums.bestRoiPower) {
+    axisSums.bestRoiPower = roiPower;
+    axisSums.features = specFeatures;
+  }
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"axis %d: roiPower=%ld, specPower=%ld",
+		     fftAxis,roiPower,specPower);
+}
 
-  // calculate spectrum power in the region of interest
-  roiPower = 0;
-  for (int i=nMin;i<nMax;i++) {
-    roiPower = roiPower + getMagnitude(fftData[i]);
+/****************************************************************
+ * axis_results():  Set the results used by alarm_check() and sent to the
+ * phone from the sums of the three axes - the power spectrum of the
+ * acceleration vector is the sum of the power spectra of its components
+ * (as is fftResults, see axis_accumulate()).
+ * The peak and centroid are those of the axis with the most ROI power.
+ */
+static void axis_results() {
+  int i;
+  specPower = clamp_power(axisSums.specPower);
+  roiPower = clamp_power(axisSums.roiPower);
+  roiRatio = power_ratio(roiPower);
+  for (i=0;i<nRoiBands;i++) {
+    roiPowers[i] = clamp_power(axisSums.roiPowers[i]);
+    roiRatios[i] = power_ratio(roiPowers[i]);
   }
+  for (i=0;i<10;i++)
+    simpleSpec[i] = (int)clamp_power(axisSums.simpleSpec[i]);
+  set_features(&axisSums.features);
+}
+#endif
+
+/****************************************************************
+ * analysis_reduce():  Reduce the spectrum in fftData to the powers used by
+ * alarm_check(), the simplified spectrum and the spectrum features sent to
+ * the phone.
+ * The power in each bin is calculated once, in a single pass, into the
+ * cumulative array specCum, so that the power in any band is found from
+ * the difference of two entries rather than by summing its bins again.
+ * The same pass finds the peak, centroid and ROI peak to mean ratio.
+ */
+static void analysis_reduce() {
+  int n;
+  short *mags;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"Calculating specPower - nSamp=%d",nSamp);
+  // Ignore position zero (DC component) and bins above the cutoff
+  // frequency.   fftResults is used by UI to display spectrum, and is left
+  // alone while it is being sent to the phone so that all the parts come
+  // from the same window.
+  mags = fftSpecBusy ? NULL : fftResults;
+#if AXIS_ANALYSIS
+  // In the per axis mode the y and z powers are added to fftResults by
+  // axis_accumulate().
+  if ((sdMode==SD_MODE_FFT_AXES) && (fftAxis>0)) mags = NULL;
+#endif
+  spec_features((int32_t*)fftData,fftExp,plan.nBins,nFreqCutoff,
+		plan.roiMin,plan.roiMax,specCum,mags,&specFeatures);
+  // specPower is average power per bin for whole spectrum (at the full
+  // sampling frequency, so that it does not change with curSampleFreq).
+  specPower = clamp_power(specFeatures.power >> specBinsBits);
+  // Goertzel mode only has the low bins, so it uses the energy of the
+  // window, which also includes the power above the cut off frequency.
+  if (sdMode==SD_MODE_GOERTZEL) specPower = energy_power(goertzelEnergy);
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"specPower=%ld",specPower);
+
   // roiPower is average power per bin within ROI.
-  roiPower = roiPower/(nMax-nMin);
+  roiPower = band_power(plan.roiMin,plan.roiMax,&plan.roiRecip);
   if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"roiPower=%ld",roiPower);
-  roiRatio = 10 * roiPower/specPower;
+  roiRatio = power_ratio(roiPower);
 
   // calculate spectrum power in each of the regions of interest
   // for multi-ROI mode.
-  roiPowers[0] = roiPower;  
-  for (n=1;n<=3;n++) {
-    roiPowers[n]=0;
-    for (int i=nMins[n];i<nMaxs[n];i++) {
-      roiPowers[n] = roiPowers[n] + getMagnitude(fftData[i]);
-    }
-    // roiPower is average power per bin within ROI.
-    roiPowers[n] = roiPowers[n]/(nMaxs[n]-nMins[n]);
-    roiRatios[n] = 10 * roiPowers[n]/specPower;
+  for (n=0;n<nRoiBands;n++) {
+    roiPowers[n] = band_power(plan.roiMins[n],plan.roiMaxs[n],
+			      &plan.roiRecips[n]);
+    roiRatios[n] = power_ratio(roiPowers[n]);
     if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"roiPower[%d]=%ld",n,roiPowers[n]);
   }
-  
 
   // Calculate the simplified spectrum - power in 1Hz bins.
   for (int ifreq=0;ifreq<10;ifreq++) {
-    int binMin = 1 + 1000*ifreq/freqRes;    // add 1 to loose dc component
-    int binMax = 1 + 1000*(ifreq+1)/freqRes;
-    simpleSpec[ifreq]=0;
-    for (int ibin=binMin;ibin<binMax;ibin++) {
-      simpleSpec[ifreq] = simpleSpec[ifreq] + getMagnitude(fftData[ibin]);
+    simpleSpec[ifreq] = band_power(plan.specMins[ifreq],plan.specMaxs[ifreq],
+				   &plan.specRecips[ifreq]);
+  }
+
+  set_features(&specFeatures);
+
+#if AXIS_ANALYSIS
+  if (sdMode==SD_MODE_FFT_AXES) {
+    axis_accumulate();
+    // The work space is still needed for the other axes.
+    if (fftAxis<2) return;
+    axis_results();
+    axis_release();
+  }
+#endif
+
+  /* The work space is free for the next window */
+  workBufBusy = 0;
+}
+
+/****************************************************************
+ * analysis_set_freq():  Set the accelerometer sampling frequency to
+ * newFreq, and work out the decimation factor and the sampling frequency
+ * of the data that is analysed.   If decimate is set the data is reduced to
+ * DECIMATE_FREQ, as long as the ROI is within the pass band of the
+ * decimation filter (up to 0.4 x DECIMATE_FREQ).
+ */
+static void analysis_set_freq(int newFreq) {
+  accelFreq = newFreq;
+  decimFactor = 1;
+  if (decimate && (sdMode!=SD_MODE_RAW)
+      && (accelFreq>DECIMATE_FREQ) && (accelFreq%DECIMATE_FREQ==0)
+      && (1000*alarmFreqMax<=400*DECIMATE_FREQ))
+    decimFactor = accelFreq/DECIMATE_FREQ;
+  // decim_init() only supports some factors.
+  if (!decim_init(&decimator,decimFactor)) decimFactor = 1;
+#if AXIS_ANALYSIS
+  for (int k=0;k<2;k++) decim_init(&axisDecimators[k],decimFactor);
+#endif
+  curSampleFreq = accelFreq/decimFactor;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"analysis_set_freq(): accelFreq=%d, decimFactor=%d",
+		     accelFreq,decimFactor);
+}
+
+/****************************************************************
+ * plan_band():  Clamp the band binMin to binMax-1 to the spectrum, store it
+ * in *pMin and *pMax, and set *recip to the reciprocal of its width.
+ */
+static void plan_band(int binMin, int binMax, int *pMin, int *pMax,
+		      struct spec_recip *recip) {
+  if (binMin<1) binMin = 1;
+  if (binMin>plan.nBins) binMin = plan.nBins;
+  if (binMax>plan.nBins) binMax = plan.nBins;
+  if (binMax<binMin) binMax = binMin;
+  *pMin = binMin;
+  *pMax = binMax;
+  spec_recip_init(recip,binMax-binMin);
+}
+
+/****************************************************************
+ * analysis_plan_build():  Work out the frequency resolution and the bin
+ * numbers of the region(s) of interest, cut-off frequency and simplified
+ * spectrum for the current window size and sampling frequency.
+ */
+static void analysis_plan_build() {
+  int i;
+  // Calculate the frequency resolution of the output spectrum.
+  // Stored as an integer which is 1000 x the frequency resolution in Hz.
+  freqRes = (int)(1000*curSampleFreq/nSamp);
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"T=%d ms, freqRes=%d Hz/(1000 bins)",
+		     1000*nSamp/curSampleFreq,freqRes);
+  plan.nBins = nSamp/2;
+
+  // The radix-4 FFT needs half as many stages as the radix-2 one, so use
+  // it if there is a kernel for this window size.
+  nFftStages = fftBits;
+#if FFT_RADIX4
+  if (fft_r4_init(&fftR4,fftBits))
+    nFftStages = fft_r4_stages(&fftR4);
+#endif
+
+  // Set the frequency bounds for the analysis in fft output bin numbers.
+  nMin = (int)(1000*alarmFreqMin/freqRes);
+  nMax = (int)(1000*alarmFreqMax/freqRes);
+  plan_band(nMin,nMax,&plan.roiMin,&plan.roiMax,&plan.roiRecip);
+
+  // Set frequency bounds for multi-ROI mode - either the list set by the
+  // phone (in mHz), or the default ROIs.
+  if (nRois>0) {
+    nRoiBands = nRois;
+    for (i=0;i<nRois;i++) {
+      nMins[i] = roiFreqs[2*i]/freqRes;
+      nMaxs[i] = roiFreqs[2*i+1]/freqRes;
     }
-    simpleSpec[ifreq] = simpleSpec[ifreq] / (binMax-binMin);
-    
+  } else {
+    nRoiBands = 4;
+    // ROI 0 is the whole ROI
+    nMins[0] = nMin;
+    nMaxs[0] = nMax;
+
+    // ROI 1 is the lower half
+    nMins[1] = nMin;
+    nMaxs[1] = (nMin+nMax)/2;
+
+    // ROI 2 is the upper half
+    nMins[2] = (nMin+nMax)/2;
+    nMaxs[2] = nMax;
+
+    // ROI 3 is the middle half
+    nMins[3] = nMin + (nMax-nMin)/4;
+    nMaxs[3] = nMax - (nMax-nMin)/4;
   }
+  for (i=0;i<nRoiBands;i++)
+    plan_band(nMins[i],nMaxs[i],&plan.roiMins[i],&plan.roiMaxs[i],
+	      &plan.roiRecips[i]);
 
+  // Simplified spectrum - 1 Hz bands, ignoring bin 0 (DC component).
+  for (i=0;i<10;i++)
+    plan_band(1 + 1000*i/freqRes,1 + 1000*(i+1)/freqRes,
+	      &plan.specMins[i],&plan.specMaxs[i],&plan.specRecips[i]);
 
-  /* Start collecting new buffer of data */
-  /* FIXME = it would be best to make this a rolling buffer and analyse it
-  * more frequently.
-  */
-  accDataPos = 0;
-  accDataFull = 0;
+  // Calculate the bin number of the cutoff frequency
+  nFreqCutoff = (int)(1000*freqCutoff/freqRes);
+
+  // Goertzel mode only calculates the bins of the simplified spectrum and
+  // ROIs - its specPower comes from the energy of the window.
+  plan.nTop = plan.specMaxs[9];
+  if (plan.roiMax>plan.nTop) plan.nTop = plan.roiMax;
+  for (i=0;i<nRoiBands;i++)
+    if (plan.roiMaxs[i]>plan.nTop) plan.nTop = plan.roiMaxs[i];
+  if (plan.nTop>plan.nBins) plan.nTop = plan.nBins;
+
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"analysis_plan_build():  nMin=%d, nMax=%d, nFreqCutoff=%d, fftBits=%d, nSamp=%d",
+		     nMin,nMax,nFreqCutoff,fftBits,nSamp);
+
+  if (debug) for (i=0;i<nRoiBands;i++) {
+      APP_LOG(APP_LOG_LEVEL_DEBUG,"analysis_plan_build(): nMins[%d]=%d, nMaxs[%d]=%d",
+	      i,nMins[i],i,nMaxs[i]);
+    }
 }
 
-void analysis_init() {
+/****************************************************************
+ * analysis_configure():  Set up the analysis for the current sampling
+ * frequency (accelFreq and curSampleFreq) - window size, hop, frequency
+ * resolution, decimator, sliding DFT, filters and fall detector.
+ */
+static void analysis_configure() {
   int nsInit;  // initial number of samples per period, before rounding
   int i,ns;
-  // Zero all data arrays:
-  for (i = 0; i<NSAMP_MAX; i++) {
-    accData[i] = 0;
-  }
 
   // Initialise analysis of accelerometer data.
-  // get number of samples per period, and round up to a power of 2
-  nsInit = samplePeriod * sampleFreq;
-  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG, "samplePeriod=%d, sampleFreq=%d - nsInit=%d",
-	  samplePeriod,sampleFreq,nsInit);
+  // get number of samples per period, and round up to a power of 2 - the
+  // window is limited to NSAMP_MAX samples, which depends on the platform.
+  nsInit = samplePeriod * curSampleFreq;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG, "samplePeriod=%d, curSampleFreq=%d - nsInit=%d",
+	  samplePeriod,curSampleFreq,nsInit);
 
   for (i=0;i<1000;i++) {
     ns = 2<<i;
       if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG, "i=%d  ns=%d nsInit = %d",
 	    i,ns,nsInit);
-    if (ns >= nsInit) {
+    if ((ns >= nsInit) || (2*ns > NSAMP_MAX)) {
       nSamp = ns;
       fftBits = i;
       break;
@@ -327,13 +1152,359 @@ void analysis_init() {
   if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG, "nSamp rounded up to %d",
 		     nSamp);
 
-  
+  // specPower is averaged over the number of bins we would have at the
+  // full sampling frequency, so it does not change with the sampling rate.
+  specBinsBits = fftBits;
+  for (i=curSampleFreq;i<sampleFreq;i=i*2) specBinsBits++;
+
+  // The analysis period can not be longer than the sample period, otherwise
+  // we would skip data between windows.
+  if ((analysisPeriod<1) || (analysisPeriod>samplePeriod))
+    analysisPeriod = samplePeriod;
+  nHop = analysisPeriod * curSampleFreq;
+  if (nHop>nSamp) nHop = nSamp;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG, "analysisPeriod=%d, nHop=%d",
+		     analysisPeriod,nHop);
+
+  // Choose update rate
+  accel_service_set_sampling_rate(accelFreq);
+
+  analysis_plan_build();
+  sdft_init();
+  filter_init();
+
+  // Convert the fall detector times from ms to samples - the fall detector
+  // uses the data before it is decimated.
+  fall_init(&fallDetector,fallThreshMin,fallThreshMax,
+	    fallWindow*accelFreq/1000,FALL_STILL_TOL,
+	    fallStillTime*accelFreq/1000,
+	    FALL_STILL_TIMEOUT*accelFreq/1000);
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"Analysis Init: fall window=%d samples",
+		     fallDetector.window);
+}
+
+/****************************************************************
+ * analysis_set_rate():  Change the accelerometer sampling frequency to
+ * newFreq, which must be sampleFreq or sampleFreq divided by a power of 2.
+ * If the sampling frequency of the analysed data changes (it does not when
+ * the data is decimated to DECIMATE_FREQ), the data in accData is
+ * resampled to the new rate (averaging groups of
+ * samples when the rate is reduced, linear interpolation when it is
+ * increased), so no data is lost and a window is ready as soon as it would
+ * have been at the old rate.  The sliding DFT, filters and motion gate
+ * sums are brought up to date by replaying the resampled data, and
+ * accDataFull is set again for the resampled buffer.  The fall detector
+ * uses the raw samples at the accelerometer rate, not accData, so it is
+ * not replayed - a fall in progress carries on at the new rate.
+ * Must only be called when no analysis is in progress (workBufBusy=0)
+ * because fftBuf is used as work space.
+ */
+static void analysis_set_rate(int newFreq) {
+  int oldFreq = curSampleFreq;
+  int oldAccelFreq = accelFreq;
+  struct fall_detector oldFall = fallDetector;
+  int nOld = accDataCount;
+  int oldPos = accDataPos;
+  int wasFull;
+  int n,i,k,f;
+  int32_t acc;
+
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"analysis_set_rate(): %d Hz -> %d Hz",
+		     accelFreq,newFreq);
+
+  // Copy the data into the work space, oldest sample first.
+  if (nOld<nSamp) {
+    for (i=0;i<nOld;i++) fftBuf[i] = accData[i];
+  } else {
+    window_copy(accData,oldPos);
+  }
+
+  analysis_set_freq(newFreq);
+  analysis_configure();
+  fall_resume(&fallDetector,&oldFall,oldAccelFreq,accelFreq);
+
+  // Resample into accData, keeping the most recent data.
+  if (curSampleFreq<oldFreq) {
+    f = oldFreq/curSampleFreq;
+    n = nOld/f;
+    if (n>nSamp) n = nSamp;
+    for (i=0;i<n;i++) {
+      acc = 0;
+      for (k=0;k<f;k++)
+	acc += fftBuf[nOld-(n-i)*f+k];
+      accData[i] = acc/f;
+    }
+    hopCount = hopCount/f;
+  } else {
+    f = curSampleFreq/oldFreq;
+    n = nOld*f;
+    if (n>nSamp) n = nSamp;
+    // Sample i is interpolated between old samples i0-1 and i0 so that the
+    // newest sample is unchanged.
+    for (i=0;i<n;i++) {
+      int j = nOld*f - n + i;     // position at the new rate
+      int i0 = j/f;
+      k = j%f;
+      acc = fftBuf[i0];
+      if (i0>0)
+	acc = fftBuf[i0-1] + (fftBuf[i0]-fftBuf[i0-1])*(k+1)/f;
+      accData[i] = acc;
+    }
+    hopCount = hopCount*f;
+  }
+#if AXIS_ANALYSIS
+  // The y and z buffers are not resampled, so the data is discarded if the
+  // rate changes (it does not when the data is decimated).  Otherwise they
+  // are put in the same order as accData.
+  if (sdMode==SD_MODE_FFT_AXES) {
+    if (curSampleFreq!=oldFreq) {
+      n = 0;
+      hopCount = 0;
+    } else if (nOld>=nSamp) {
+      for (k=0;k<2;k++) {
+	window_copy(accAxes[k],oldPos);
+	for (i=0;i<nSamp;i++) accAxes[k][i] = fftBuf[i];
+      }
+    }
+    for (k=0;k<2;k++) {
+      for (i=n;i<NSAMP_MAX;i++) accAxes[k][i] = 0;
+      axisSum[k] = 0;
+      axisSumSq[k] = 0;
+      for (i=0;i<n;i++) {
+	axisSum[k] += accAxes[k][i];
+	axisSumSq[k] += (int64_t)accAxes[k][i]*accAxes[k][i];
+      }
+    }
+  }
+#endif
+  for (i=n;i<NSAMP_MAX;i++) accData[i] = 0;
+  accDataCount = n;
+  accDataPos = (n<nSamp) ? n : 0;
+
+  // Replay the data to bring the running state up to date.
+  accSum = 0;
+  accSumSq = 0;
+  for (i=0;i<n;i++) {
+    acc = accData[i];
+    accSum += acc;
+    accSumSq += (int64_t)acc*acc;
+    if (sdMode==SD_MODE_SDFT) sdft_update(acc,0);
+    else if (sdMode==SD_MODE_FILTER) filter_update(acc);
+  }
+  if (hopCount>nSamp) hopCount = nSamp;
+
+  // The change of rate can make a window ready, or stop one that was
+  // waiting being ready - analysis_timer_callback() starts the analysis
+  // if there is one.
+  wasFull = accDataFull;
+  accDataFull = ((accDataCount>=nSamp) || (sdMode==SD_MODE_FILTER))
+    && (hopCount>=nHop);
+  if (accDataFull && !wasFull) accDataFullTime = get_time_ms();
+}
+
+/****************************************************************
+ * adaptive_rate_check():  Adaptive sampling rate controller, called after
+ * each alarm check.  Reduces the sampling frequency to ADAPTIVE_FREQ_LOW
+ * once the ROI power has been below adaptiveRate for ADAPTIVE_QUIET_TIME
+ * seconds, and goes back to the full sampleFreq as soon as it rises above
+ * adaptiveRate or there is an alarm condition.
+ */
+static void adaptive_rate_check() {
+  int newFreq = sampleFreq;
+
+  if ((adaptiveRate>0) && (sdMode!=SD_MODE_RAW)
+      && (sampleFreq>ADAPTIVE_FREQ_LOW)
+      && (sampleFreq%ADAPTIVE_FREQ_LOW==0)) {
+    if ((roiPower<adaptiveRate) && (alarmState==ALARM_STATE_OK)) {
+      if (quietTime<ADAPTIVE_QUIET_TIME) quietTime += analysisPeriod;
+    } else {
+      quietTime = 0;
+    }
+    if (quietTime>=ADAPTIVE_QUIET_TIME) newFreq = ADAPTIVE_FREQ_LOW;
+  }
+  if (newFreq!=accelFreq) analysis_set_rate(newFreq);
+}
+
+/****************************************************************
+ * fft_stage():  Run stage n of the FFT of fftData (0 is the permutation,
+ * then the butterfly stages), with the radix-4 kernel if there is one for
+ * the window size.   Returns the change in the block exponent.
+ */
+static int fft_stage(int n) {
+#if FFT_RADIX4
+  if (fftR4.bits) {
+    if (n==0) {
+      fft_r4_permutate(&fftR4,fftData);
+      return 0;
+    }
+    return fft_r4_stage_bfp(&fftR4,fftData,n-1);
+  }
+#endif
+  if (n==0) {
+    fft_permutate(fftData,fftBits);
+    return 0;
+  }
+  return fft_forward_stage_bfp(fftData,fftBits,n-1);
+}
+
+/****************************************************************
+ * analysis_step():  Carry out the next step of the analysis of a window of
+ * data to check for seizures.   The FFT is done one stage per step so that
+ * the analysis can be split up into short slices of work.
+ */
+static void analysis_step() {
+  switch (analysisStep) {
+  case ANALYSIS_STEP_START:
+    analysis_start();
+    if (motionGated || (sdMode==SD_MODE_FILTER))
+      analysisStep = ANALYSIS_STEP_ALARM;
+    else if (sdMode==SD_MODE_SDFT)
+      analysisStep = ANALYSIS_STEP_REDUCE;
+    else if (sdMode==SD_MODE_GOERTZEL)
+      analysisStep = ANALYSIS_STEP_GOERTZEL;
+    else {
+      fftStage = 0;
+      analysisStep = ANALYSIS_STEP_FFT;
+    }
+    break;
+  case ANALYSIS_STEP_FFT:
+    // Do the FFT conversion from time to frequency domain.
+    // The output is stored in fftBuf.  fftData is a pointer to fftBuf.
+    // Equivalent to fftExp = fft_fftr_bfp(fftData,fftBits) - the block
+    // floating point FFT keeps the precision of quiet signals.  The radix-4
+    // kernels are used for the window sizes they cover.
+    if (fftStage==0) fftExp = 0;
+    fftExp += fft_stage(fftStage);
+    fftStage++;
+    if (fftStage>nFftStages) analysisStep = ANALYSIS_STEP_CONVERT;
+    break;
+  case ANALYSIS_STEP_GOERTZEL:
+    if (goertzel_step()) analysisStep = ANALYSIS_STEP_REDUCE;
+    break;
+  case ANALYSIS_STEP_CONVERT:
+    fftExp += fft_normalise(fftData,nSamp/2,FFT_CONVERT_HEADROOM);
+    fft_convert(fftData,fftBits,false,false);
+    analysisStep = ANALYSIS_STEP_REDUCE;
+    break;
+  case ANALYSIS_STEP_REDUCE:
+    analysis_reduce();
+    analysisStep = ANALYSIS_STEP_ALARM;
+#if AXIS_ANALYSIS
+    // Transform the next axis, if there is one.
+    if ((sdMode==SD_MODE_FFT_AXES) && (fftAxis<2)) {
+      fftAxis++;
+      window_copy(accAxes[fftAxis-1],axisWindowPos);
+      fftStage = 0;
+      analysisStep = ANALYSIS_STEP_FFT;
+    }
+#endif
+    break;
+  case ANALYSIS_STEP_ALARM:
+    // Check the alarm state, and set the global alarmState variable.
+    alarm_check();
+    analysisLatency = get_time_ms() - accDataFullTime;
+    if (analysisLatency>analysisLatencyMax)
+      analysisLatencyMax = analysisLatency;
+    if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"analysis latency=%lu ms, max=%lu ms",
+		       (unsigned long)analysisLatency,
+		       (unsigned long)analysisLatencyMax);
+    process_alarm_state();
+    adaptive_rate_check();
+    analysisStep = ANALYSIS_STEP_IDLE;
+    break;
+  default:
+    analysisStep = ANALYSIS_STEP_IDLE;
+  }
+}
+
+/****************************************************************
+ * analysis_timer_callback():  Run steps of the analysis until it is
+ * complete or analysisSlice ms have been used (analysisSlice=0 runs the
+ * whole analysis at once).  If there is more to do, the timer is
+ * re-registered so that button presses and redraws can be handled before
+ * the next slice.
+ * Records the longest time spent in a single callback in analysisBlockMax.
+ */
+static void analysis_timer_callback(void *data) {
+  uint32_t tStart = get_time_ms();
+  uint32_t tSlice;
+  analysisTimer = NULL;
+  if (analysisStep==ANALYSIS_STEP_IDLE) {
+    if (!accDataFull) return;
+    analysisStep = ANALYSIS_STEP_START;
+  }
+  do {
+    analysis_step();
+    tSlice = get_time_ms() - tStart;
+  } while ((analysisStep!=ANALYSIS_STEP_IDLE)
+	   && ((analysisSlice==0) || (tSlice<(uint32_t)analysisSlice)));
+
+  if (tSlice>analysisBlockMax) {
+    analysisBlockMax = tSlice;
+    if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"analysis_timer_callback() - max blocking time=%lu ms",
+		       (unsigned long)analysisBlockMax);
+  }
+
+  // Carry on with this analysis, or start the next one if another window
+  // became ready while we were working.
+  if ((analysisStep!=ANALYSIS_STEP_IDLE) || accDataFull)
+    analysisTimer = app_timer_register(0,analysis_timer_callback,NULL);
+}
+
+/****************************************************************
+ * analysis_init():  (Re-)start the analysis, discarding any data collected.
+ */
+void analysis_init() {
+  int i;
+#if !AXIS_ANALYSIS
+  if (sdMode==SD_MODE_FFT_AXES) sdMode = SD_MODE_FFT;
+#endif
+#if !SDFT_ANALYSIS
+  if (sdMode==SD_MODE_SDFT) sdMode = SD_MODE_FFT;
+#endif
+#if !FILTER_ANALYSIS
+  if (sdMode==SD_MODE_FILTER) sdMode = SD_MODE_FFT;
+#endif
+  // Zero all data arrays:
+  for (i = 0; i<NSAMP_MAX; i++) {
+    accData[i] = 0;
+  }
+#if AXIS_ANALYSIS
+  memset(accAxes,0,sizeof(accAxes));
+  memset(axisSum,0,sizeof(axisSum));
+  memset(axisSumSq,0,sizeof(axisSumSq));
+  axisPendingCount = 0;
+  axisFrozen = 0;
+#endif
+  fftResultsBuilding = 0;
+  commsDataReset();
+  accDataPos = 0;
+  accDataCount = 0;
+  accDataFull = 0;
+  accSum = 0;
+  accSumSq = 0;
+  hopCount = 0;
+  workBufBusy = 0;
+  if (analysisTimer!=NULL) {
+    app_timer_cancel(analysisTimer);
+    analysisTimer = NULL;
+  }
+  analysisStep = ANALYSIS_STEP_IDLE;
+  quietTime = 0;
+  // Filter mode does not calculate a spectrum, so has no spectrum features.
+  maxVal = maxLoc = maxFreq = 0;
+  peakFreq = specCentroid = roiPeakRatio = 0;
+
   /* Subscribe to acceleration data service */
   if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"Analysis Init:  Subcribing to acceleration data at frequency %d Hz",sampleFreq);
   accel_data_service_subscribe(25,accel_handler);
-  // Choose update rate
-  accel_service_set_sampling_rate(sampleFreq);
 
-  fftData = (fft_complex_t*)accData;
+  fftData = (fft_complex_t*)fftBuf;
+  // Fills the sine table, unless it was generated at build time.
+  sine_init();
+
+  analysis_set_freq(sampleFreq);
+  analysis_configure();
+  fallDetected = 0;
 }
 
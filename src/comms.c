@@ -23,8 +23,54 @@
 
 */
 #include "pebble_sd.h"
+#include "rawpack.h"
+#include "respack.h"
 void sendSettings();
-void sendFftSpec();
+static void commsPump();
+static void writeSettings(DictionaryIterator *iter);
+
+// Kinds of message sent to the phone, highest priority first.
+#define COMMS_MSG_ALARM 0     // Results while in an alarm state.
+#define COMMS_MSG_RESULTS 1   // Results.
+#define COMMS_MSG_SETTINGS 2  // Settings.
+#define COMMS_MSG_SPEC 3      // Part of the spectrum.
+#define COMMS_MSG_RAW 4       // Raw mode data.
+#define COMMS_MSG_TYPES 5
+
+// Outbound message queue - a flag for each kind of message rather than a
+// copy of it, because messages are built from the latest data when they
+// reach the outbox.  A request for a message that is already waiting
+// replaces it (the newer results supersede the older ones).
+int commsPending[COMMS_MSG_TYPES];  // Message is waiting to be sent.
+int commsFailures[COMMS_MSG_TYPES]; // Failed attempts to send the message.
+int commsInFlight = -1; // Kind of message in the outbox (-1 = outbox free).
+AppTimer *commsRetryTimer = NULL; // Timer to retry after a failed send.
+uint32_t commsDropped = 0;   // Messages abandoned after COMMS_RETRY_MAX
+                             // failed attempts.
+uint32_t commsRetries = 0;   // Messages resent after a failure.
+uint32_t commsCoalesced = 0; // Requests merged with a waiting message.
+
+// Raw mode data waiting to be sent to the phone - a ring of samples written
+// by sendRawData() and sent in messages of up to RAW_MSG_SAMPLES by
+// writeRawData(), in the format set by rawFormat.
+int16_t rawRing[RAW_RING_SAMPLES][3];
+int32_t rawMsg[RAW_MSG_SAMPLES]; // Raw data message being built.
+int rawRingHead = 0;    // Position in rawRing of the oldest unsent sample.
+int rawRingCount = 0;   // Number of samples in rawRing.
+int rawInFlight = 0;    // Number of rawRing samples in the message being sent
+                        // (0 if the outbox is not sending raw data).
+uint32_t rawBatchesDropped = 0; // Number of batches lost because rawRing
+                        // was full.
+
+// Spectrum being sent to the phone by sendFftSpec(), SPEC_MSG_BINS bins of
+// fftResults at a time.
+int fftSpecBusy = 0;    // Flag to say fftResults is being sent (and must
+                        // not be updated).
+int fftSpecDeferred = 0; // Flag to say the spectrum is to be sent once
+                        // fftResults is complete.
+int specSendPos = 0;    // First bin still to be sent.
+int specSendEnd = 0;    // Number of bins to send.
+int specInFlight = 0;   // Number of bins in the message being sent.
 
 
 /*************************************************************
@@ -48,7 +94,10 @@ void inbox_received_callback(DictionaryIterator *iterator, void *context) {
       break;
     case KEY_DATA_TYPE:
       APP_LOG(APP_LOG_LEVEL_INFO, "***********Phone Requesting Data");
-      sendSdData();
+      if (t->value->uint8==DATA_TYPE_SPEC)
+	sendFftSpec();
+      else
+	sendSdData();
       break;
     case KEY_SET_SETTINGS:
       APP_LOG(APP_LOG_LEVEL_INFO, "***********Phone Setting Settings");
@@ -68,6 +117,46 @@ void inbox_received_callback(DictionaryIterator *iterator, void *context) {
 	      samplePeriod = (int)t->value->int16);
       settingsChanged = 1;
       break;
+    case KEY_ANALYSIS_PERIOD:
+      APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting ANALYSIS_PERIOD to %d",
+	      analysisPeriod = (int)t->value->int16);
+      settingsChanged = 1;
+      break;
+    case KEY_ANALYSIS_SLICE:
+      APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting ANALYSIS_SLICE to %d",
+	      analysisSlice = (int)t->value->int16);
+      break;
+    case KEY_MOTION_FLOOR:
+      APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting MOTION_FLOOR to %d",
+	      motionFloor = (int)t->value->int16);
+      break;
+    case KEY_ADAPTIVE_RATE:
+      APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting ADAPTIVE_RATE to %d",
+	      adaptiveRate = (int)t->value->int16);
+      break;
+    case KEY_DECIMATE:
+      APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting DECIMATE to %d",
+	      decimate = (int)t->value->int16);
+      settingsChanged = 1;
+      break;
+    case KEY_RAW_FORMAT:
+      // rawRing holds all three axes, so the format can change at any time.
+      APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting RAW_FORMAT to %d",
+	      rawFormat = (int)t->value->int16);
+      break;
+    case KEY_RESULTS_FORMAT:
+      APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting RESULTS_FORMAT to %d",
+	      resultsFormat = (int)t->value->int16);
+      break;
+    case KEY_ROI_LIST:
+      // pairs of uint16 ROI bounds in mHz - an empty list restores the
+      // default ROIs.
+      nRois = t->length / (2*sizeof(roiFreqs[0]));
+      if (nRois>ROI_MAX) nRois = ROI_MAX;
+      memcpy(roiFreqs,t->value->data,nRois*2*sizeof(roiFreqs[0]));
+      APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting ROI_LIST to %d ROIs",nRois);
+      settingsChanged = 1;
+      break;
     case KEY_SAMPLE_FREQ:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting SAMPLE_FREQ to %d",
 	      sampleFreq = (int)t->value->int16);
@@ -85,14 +174,17 @@ void inbox_received_callback(DictionaryIterator *iterator, void *context) {
     case KEY_SD_MODE:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting SD_MODE to %d",
 	      sdMode = (int)t->value->int16);
+      settingsChanged = 1;
       break;
     case KEY_ALARM_FREQ_MIN:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting ALARM_FREQ_MIN to %d",
 	      alarmFreqMin = (int)t->value->int16);
+      settingsChanged = 1;
       break;
     case KEY_ALARM_FREQ_MAX:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting ALARM_FREQ_MAX to %d",
 	      alarmFreqMax = (int)t->value->int16);
+      settingsChanged = 1;
       break;
     case KEY_WARN_TIME:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting WARN_TIME to %d",
@@ -113,18 +205,27 @@ void inbox_received_callback(DictionaryIterator *iterator, void *context) {
     case KEY_FALL_ACTIVE:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting FALL_ACTIVE to %d",
 	      fallActive = (int)t->value->int16);
+      settingsChanged = 1;
       break;
     case KEY_FALL_THRESH_MIN:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting FALL_THRESH_MIN to %d",
 	      fallThreshMin = (int)t->value->int16);
+      settingsChanged = 1;
       break;
     case KEY_FALL_THRESH_MAX:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting FALL_THRESH_MAX to %d",
 	      fallThreshMax = (int)t->value->int16);
+      settingsChanged = 1;
       break;
     case KEY_FALL_WINDOW:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting FALL_WINDOW to %d",
 	      fallWindow = (int)t->value->int16);
+      settingsChanged = 1;
+      break;
+    case KEY_FALL_STILL_TIME:
+      APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting FALL_STILL_TIME to %d",
+	      fallStillTime = (int)t->value->int16);
+      settingsChanged = 1;
       break;
     case KEY_MUTE_PERIOD:
       APP_LOG(APP_LOG_LEVEL_INFO,"Phone Setting MUTE_PERIOD to %d",
@@ -148,58 +249,351 @@ void inbox_dropped_callback(AppMessageResult reason, void *context) {
   APP_LOG(APP_LOG_LEVEL_ERROR, "Message dropped!");
 }
 
+/*******************************************************
+ * rawRelease():  Remove the oldest n samples from rawRing.
+ */
+static void rawRelease(int n) {
+  rawRingHead = (rawRingHead + n) % RAW_RING_SAMPLES;
+  rawRingCount -= n;
+}
+
+/*******************************************************
+ * Called when the outbox fails to deliver the message, or it could not be
+ * sent at all.  The message is queued again and retried after a delay
+ * that doubles with each failure (COMMS_RETRY_MS, 2xCOMMS_RETRY_MS,...)
+ * until it has failed COMMS_RETRY_MAX times, when it is abandoned.
+ */
+static void comms_retry_callback(void *data) {
+  commsRetryTimer = NULL;
+  commsPump();
+}
+
+static void commsFailed(int kind) {
+  int n = rawInFlight;
+  commsInFlight = -1;
+  rawInFlight = 0;
+  specInFlight = 0;
+  commsFailures[kind]++;
+  if (commsFailures[kind]>COMMS_RETRY_MAX) {
+    commsFailures[kind] = 0;
+    commsDropped++;
+    APP_LOG(APP_LOG_LEVEL_WARNING,"commsFailed() - message type %d abandoned, total=%lu",
+	    kind,(unsigned long)commsDropped);
+    // Make room for new raw data rather than trying the same samples again.
+    if (kind==COMMS_MSG_RAW) {
+      rawRelease(n);
+      commsPending[kind] = (rawRingCount>=RAW_MSG_SAMPLES);
+    }
+    // A spectrum with a part missing is no use, so give up on all of it.
+    if (kind==COMMS_MSG_SPEC) fftSpecBusy = 0;
+    commsPump();
+  } else {
+    commsPending[kind] = 1;
+    commsRetries++;
+    if (commsRetryTimer==NULL)
+      commsRetryTimer =
+	app_timer_register(COMMS_RETRY_MS<<(commsFailures[kind]-1),
+			   comms_retry_callback,NULL);
+  }
+}
+
 void outbox_failed_callback(DictionaryIterator *iterator, AppMessageResult reason, void *context) {
-  APP_LOG(APP_LOG_LEVEL_ERROR, "Outbox send failed!");
+  APP_LOG(APP_LOG_LEVEL_ERROR, "Outbox send failed! - reason=%d",(int)reason);
+  if (commsInFlight>=0) commsFailed(commsInFlight);
 }
 
 void outbox_sent_callback(DictionaryIterator *iterator, void *context) {
+  int kind = commsInFlight;
   if (debug) APP_LOG(APP_LOG_LEVEL_INFO, "Outbox send success!");
+  commsInFlight = -1;
+  if (kind>=0) commsFailures[kind] = 0;
+  // Release the raw data the outbox held, and send the next message if
+  // enough has built up.
+  if (rawInFlight>0) {
+    rawRelease(rawInFlight);
+    rawInFlight = 0;
+    if (rawRingCount>=RAW_MSG_SAMPLES) commsPending[COMMS_MSG_RAW] = 1;
+  }
+  // Stream the rest of the spectrum, a part at a time - results still go
+  // first if they are waiting.
+  if (specInFlight>0) {
+    specSendPos += specInFlight;
+    specInFlight = 0;
+    if (specSendPos<specSendEnd)
+      commsPending[COMMS_MSG_SPEC] = 1;
+    else
+      fftSpecBusy = 0;
+  }
+  commsPump();
 }
 
 /***************************************************
- * Send some Seizure Detector Data to the phone app.
+ * Write the Seizure Detector Data as a packed record (respack.h).
  */
-void sendSdData() {
-  DictionaryIterator *iter;
-  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"sendSdData()");
-  app_message_outbox_begin(&iter);
+static void writeSdDataPacked(DictionaryIterator *iter, int nQueued) {
+  struct sd_results r;
+  uint8_t buf[RESPACK_SIZE_MAX];
+  int i;
+  r.alarmState = alarmState;
+  r.alarmRoi = alarmRoi;
+  r.sampleFreq = curSampleFreq;
+  r.maxFreq = maxFreq;
+  r.roiPeakRatio = roiPeakRatio;
+  r.commsQueued = nQueued;
+  r.specPower = specPower;
+  r.roiPower = roiPower;
+  r.maxVal = maxVal;
+  r.peakFreq = peakFreq;
+  r.specCentroid = specCentroid;
+  r.numDropped = accDataDropped;
+  r.analysisLatency = analysisLatency;
+  r.maxBlockTime = analysisBlockMax;
+  r.numSkipped = fftSkipped;
+  r.commsDropped = commsDropped;
+  r.commsRetries = commsRetries;
+  r.commsCoalesced = commsCoalesced;
+  for (i=0;i<10;i++) r.simpleSpec[i] = simpleSpec[i];
+  r.haveAxes = (sdMode==SD_MODE_FFT_AXES);
+  for (i=0;i<3;i++) {
+    r.axisRoiPowers[i] = axisRoiPowers[i];
+    r.axisSpecPowers[i] = axisSpecPowers[i];
+  }
+  dict_write_uint8(iter,KEY_DATA_TYPE,(uint8_t)DATA_TYPE_RESULTS);
+  dict_write_data(iter,KEY_RESULTS_PACKED,buf,respack_encode(&r,buf));
+}
+
+/***************************************************
+ * Write the Seizure Detector Data to a message for the phone app.
+ */
+static void writeSdData(DictionaryIterator *iter) {
+  int i, nQueued = 0;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"writeSdData()");
+  for (i=0;i<COMMS_MSG_TYPES;i++) nQueued += commsPending[i];
+  if (resultsFormat==RESULTS_FORMAT_PACKED) {
+    writeSdDataPacked(iter,nQueued);
+    return;
+  }
   dict_write_uint8(iter,KEY_DATA_TYPE,(uint8_t)DATA_TYPE_RESULTS);
   dict_write_uint8(iter,KEY_ALARMSTATE,(uint8_t)alarmState);
   dict_write_uint32(iter,KEY_MAXVAL,(uint32_t)maxVal);
   dict_write_uint32(iter,KEY_MAXFREQ,(uint32_t)maxFreq);
+  dict_write_uint32(iter,KEY_PEAK_FREQ,(uint32_t)peakFreq);
+  dict_write_uint32(iter,KEY_SPEC_CENTROID,(uint32_t)specCentroid);
+  dict_write_uint32(iter,KEY_ROI_PEAK_RATIO,(uint32_t)roiPeakRatio);
   dict_write_uint32(iter,KEY_SPECPOWER,(uint32_t)specPower);
   dict_write_uint32(iter,KEY_ROIPOWER,(uint32_t)roiPower);
   dict_write_uint32(iter,KEY_ALARM_ROI,(uint32_t)alarmRoi);
+  dict_write_uint32(iter,KEY_NUM_DROPPED,accDataDropped);
+  dict_write_uint32(iter,KEY_ANALYSIS_LATENCY,analysisLatency);
+  dict_write_uint32(iter,KEY_MAX_BLOCK_TIME,analysisBlockMax);
+  dict_write_uint32(iter,KEY_NUM_SKIPPED,fftSkipped);
+  dict_write_uint32(iter,KEY_CUR_SAMPLE_FREQ,(uint32_t)curSampleFreq);
+  dict_write_uint32(iter,KEY_COMMS_QUEUED,(uint32_t)nQueued);
+  dict_write_uint32(iter,KEY_COMMS_DROPPED,commsDropped);
+  dict_write_uint32(iter,KEY_COMMS_RETRIES,commsRetries);
+  dict_write_uint32(iter,KEY_COMMS_COALESCED,commsCoalesced);
   // Send simplified spectrum - just 10 integers so it fits in a message.
   dict_write_data(iter,KEY_SPEC_DATA,(uint8_t*)(&simpleSpec[0]),
 		  10*sizeof(simpleSpec[0]));
-  app_message_outbox_send();
-  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"sent Results");
+  if (sdMode==SD_MODE_FFT_AXES) {
+    dict_write_data(iter,KEY_AXIS_ROI_POWERS,(uint8_t*)axisRoiPowers,
+		    sizeof(axisRoiPowers));
+    dict_write_data(iter,KEY_AXIS_SPEC_POWERS,(uint8_t*)axisSpecPowers,
+		    sizeof(axisSpecPowers));
+  }
 }
 
 /*******************************************************
- * Send raw accelerometer data to the phone
+ * writeRawData():  Write the oldest RAW_MSG_SAMPLES samples in rawRing to a
+ * message for the phone - as magnitudes or delta encoded x,y,z data
+ * depending on rawFormat.  The samples are only removed from rawRing once
+ * outbox_sent_callback() confirms they have been delivered.
  */
-void sendRawData(AccelData *data, uint32_t num_samples) {
+static void writeRawData(DictionaryIterator *iter) {
+  int i,n,nBytes;
+  const int16_t *s;
+  // The samples must be contiguous, so if they wrap around the end of
+  // rawRing the message is sent short and the rest goes in the next one.
+  n = RAW_RING_SAMPLES - rawRingHead;
+  if (n>RAW_MSG_SAMPLES) n = RAW_MSG_SAMPLES;
+  s = rawRing[rawRingHead];
+  if (rawFormat==RAW_FORMAT_XYZ) {
+    // As many samples as fit in rawMsg - usually all of them.
+    n = rawpack_encode(s,n,(uint8_t*)rawMsg,sizeof(rawMsg),&nBytes);
+    dict_write_uint8(iter,KEY_DATA_TYPE,(uint8_t)DATA_TYPE_RAW_XYZ);
+  } else {
+    for (i=0;i<n;i++)
+      rawMsg[i] = s[3*i]*s[3*i] + s[3*i+1]*s[3*i+1] + s[3*i+2]*s[3*i+2];
+    nBytes = n*sizeof(rawMsg[0]);
+    dict_write_uint8(iter,KEY_DATA_TYPE,(uint8_t)DATA_TYPE_RAW);
+  }
+  dict_write_uint32(iter,KEY_NUM_RAW_DATA,(uint32_t)n);
+  dict_write_uint32(iter,KEY_NUM_RAW_DROPPED,rawBatchesDropped);
+  dict_write_data(iter,KEY_RAW_DATA,(uint8_t*)rawMsg,nBytes);
+  rawInFlight = n;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"writeRawData() - %d samples",n);
+}
+
+/*******************************************************
+ * writeFftSpec():  Write the next part of the spectrum (fftResults) to a
+ * message for the phone - bins KEY_POS_MIN to KEY_POS_MAX.
+ */
+static void writeFftSpec(DictionaryIterator *iter) {
+  int n = specSendEnd - specSendPos;
+  if (n>SPEC_MSG_BINS) n = SPEC_MSG_BINS;
+  dict_write_uint8(iter,KEY_DATA_TYPE,(uint8_t)DATA_TYPE_SPEC);
+  dict_write_uint32(iter,KEY_POS_MIN,(uint32_t)specSendPos);
+  dict_write_uint32(iter,KEY_POS_MAX,(uint32_t)(specSendPos+n-1));
+  dict_write_uint32(iter,KEY_FREQ_RES,(uint32_t)freqRes);
+  dict_write_data(iter,KEY_SPEC_DATA,(uint8_t*)(&fftResults[specSendPos]),
+		  n*sizeof(fftResults[0]));
+  specInFlight = n;
+  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"writeFftSpec() - bins %d to %d",
+		     specSendPos,specSendPos+n-1);
+}
+
+/*******************************************************
+ * commsPump():  Send the highest priority waiting message, if the outbox is
+ * free and we are not waiting to retry a failed message.  Called whenever
+ * a message is queued and from the outbox callbacks.
+ */
+static void commsPump() {
   DictionaryIterator *iter;
-  int32_t accData[25];  // 25 samples.
-  for (uint8_t i=0;i<num_samples;i++) {
-    accData[i] =
-        data[i].x*data[i].x
-      + data[i].y*data[i].y
-      + data[i].z*data[i].z;
-    //accData[3*i] = data[i].x;
-    //accData[3*i+1] = data[i].y;
-    //accData[3*i+2] = data[i].z;
+  int kind;
+  if ((commsInFlight>=0) || (commsRetryTimer!=NULL)) return;
+  for (kind=0;kind<COMMS_MSG_TYPES;kind++)
+    if (commsPending[kind]) break;
+  if (kind>=COMMS_MSG_TYPES) return;
+  commsPending[kind] = 0;
+  if (app_message_outbox_begin(&iter)!=APP_MSG_OK) {
+    commsFailed(kind);
+    return;
+  }
+  switch(kind) {
+  case COMMS_MSG_ALARM:
+  case COMMS_MSG_RESULTS:
+    writeSdData(iter);
+    break;
+  case COMMS_MSG_SETTINGS:
+    writeSettings(iter);
+    break;
+  case COMMS_MSG_SPEC:
+    writeFftSpec(iter);
+    break;
+  case COMMS_MSG_RAW:
+    writeRawData(iter);
+    break;
   }
+  commsInFlight = kind;
+  if (app_message_outbox_send()!=APP_MSG_OK) commsFailed(kind);
+}
+
+/*******************************************************
+ * commsQueue():  Queue a message of type kind to be sent to the phone.
+ */
+static void commsQueue(int kind) {
+  if (commsPending[kind]) commsCoalesced++;
+  commsPending[kind] = 1;
+  if (kind==COMMS_MSG_ALARM) {
+    // Alarm results replace any ordinary results waiting, and go as soon
+    // as the outbox is free rather than waiting for a retry delay.
+    if (commsPending[COMMS_MSG_RESULTS]) {
+      commsPending[COMMS_MSG_RESULTS] = 0;
+      commsCoalesced++;
+    }
+    if (commsRetryTimer!=NULL) {
+      app_timer_cancel(commsRetryTimer);
+      commsRetryTimer = NULL;
+    }
+  } else if ((kind==COMMS_MSG_RESULTS) && commsPending[COMMS_MSG_ALARM]) {
+    commsPending[kind] = 0;
+    commsCoalesced++;
+  }
+  commsPump();
+}
+
+/***************************************************
+ * Send some Seizure Detector Data to the phone app - ahead of any other
+ * messages waiting if we are in an alarm state.
+ */
+void sendSdData() {
+  if ((alarmState!=ALARM_STATE_OK) && (alarmState!=ALARM_STATE_MUTE))
+    commsQueue(COMMS_MSG_ALARM);
+  else
+    commsQueue(COMMS_MSG_RESULTS);
+}
+
+/*******************************************************
+ * Send raw accelerometer data to the phone - the batch of num_samples is
+ * added to rawRing and sent with the following batches once there are
+ * enough to fill a message.
+ */
+void sendRawData(AccelData *data, uint32_t num_samples) {
+  int i, pos;
   if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"sendRawData() - num_samples=%ld",num_samples);
-  app_message_outbox_begin(&iter);
-  dict_write_uint8(iter,KEY_DATA_TYPE,(uint8_t)DATA_TYPE_RAW);
-  dict_write_uint32(iter,KEY_NUM_RAW_DATA,(uint32_t)num_samples);
-  dict_write_data(iter,KEY_RAW_DATA,(uint8_t*)(accData),
-		  num_samples*sizeof(accData[0]));
-  app_message_outbox_send();
-  if (debug) APP_LOG(APP_LOG_LEVEL_DEBUG,"sent Results");
+  if (rawRingCount+(int)num_samples>RAW_RING_SAMPLES) {
+    // The phone is not keeping up - drop the new batch rather than the
+    // data that is already waiting.
+    rawBatchesDropped++;
+    APP_LOG(APP_LOG_LEVEL_WARNING,"sendRawData() - raw data batch dropped, total=%lu",
+	    (unsigned long)rawBatchesDropped);
+  } else {
+    pos = (rawRingHead + rawRingCount) % RAW_RING_SAMPLES;
+    for (i=0;i<(int)num_samples;i++) {
+      rawRing[pos][0] = data[i].x;
+      rawRing[pos][1] = data[i].y;
+      rawRing[pos][2] = data[i].z;
+      if (++pos>=RAW_RING_SAMPLES) pos = 0;
+    }
+    rawRingCount += num_samples;
+  }
+  // Only one raw message is sent at a time - outbox_sent_callback() queues
+  // the next.
+  if ((rawInFlight==0) && (rawRingCount>=RAW_MSG_SAMPLES))
+    commsPending[COMMS_MSG_RAW] = 1;
+  commsPump();
+}
+
+/*******************************************************
+ * Send the spectrum (fftResults, up to the cut off frequency) to the phone,
+ * split into messages of SPEC_MSG_BINS bins which are sent one after the
+ * other from outbox_sent_callback().  fftResults is not updated until the
+ * last part has been sent.  Does nothing if a spectrum is already being
+ * sent, or the mode does not calculate one.  If fftResults is part way
+ * through being built (per axis mode) it is sent when it is complete.
+ */
+void sendFftSpec() {
+  if ((sdMode==SD_MODE_RAW) || (sdMode==SD_MODE_FILTER)) return;
+  if (fftSpecBusy) {
+    commsCoalesced++;
+    return;
+  }
+  if (fftResultsBuilding) {
+    fftSpecDeferred = 1;
+    return;
+  }
+  fftSpecDeferred = 0;
+  APP_LOG(APP_LOG_LEVEL_INFO, "sendFftSpec()");
+  fftSpecBusy = 1;
+  specSendPos = 0;
+  specSendEnd = nFreqCutoff+1;
+  if (specSendEnd>nSamp/2) specSendEnd = nSamp/2;
+  commsQueue(COMMS_MSG_SPEC);
+}
+
+/*******************************************************
+ * Discard any raw data or spectrum waiting to be sent (when the settings
+ * change).  Raw data already in the outbox stays in rawRing until
+ * outbox_sent_callback() releases it.
+ */
+void commsDataReset() {
+  rawRingCount = rawInFlight;
+  commsPending[COMMS_MSG_RAW] = 0;
+  fftSpecBusy = 0;
+  fftSpecDeferred = 0;
+  specSendPos = specSendEnd = 0;
+  specInFlight = 0;
+  commsPending[COMMS_MSG_SPEC] = 0;
 }
 
 
@@ -207,9 +601,11 @@ void sendRawData(AccelData *data, uint32_t num_samples) {
  * Send Seizure Detector Settings to the Phone
  */
 void sendSettings() {
-  DictionaryIterator *iter;
   APP_LOG(APP_LOG_LEVEL_INFO, "sendSettings()");
-  app_message_outbox_begin(&iter);
+  commsQueue(COMMS_MSG_SETTINGS);
+}
+
+static void writeSettings(DictionaryIterator *iter) {
   // Tell the phone this is settings data
   dict_write_uint8(iter,KEY_DATA_TYPE,(uint8_t)DATA_TYPE_SETTINGS);
   dict_write_uint8(iter,KEY_SETTINGS,(uint8_t)1);
@@ -223,6 +619,13 @@ void sendSettings() {
 		   (uint8_t)__pbl_app_info.process_version.minor);
   // then the settings
   dict_write_uint32(iter,KEY_SAMPLE_PERIOD,(uint32_t)samplePeriod);
+  dict_write_uint32(iter,KEY_ANALYSIS_PERIOD,(uint32_t)analysisPeriod);
+  dict_write_uint32(iter,KEY_ANALYSIS_SLICE,(uint32_t)analysisSlice);
+  dict_write_uint32(iter,KEY_MOTION_FLOOR,(uint32_t)motionFloor);
+  dict_write_uint32(iter,KEY_ADAPTIVE_RATE,(uint32_t)adaptiveRate);
+  dict_write_uint32(iter,KEY_DECIMATE,(uint32_t)decimate);
+  dict_write_uint32(iter,KEY_RAW_FORMAT,(uint32_t)rawFormat);
+  dict_write_uint32(iter,KEY_RESULTS_FORMAT,(uint32_t)resultsFormat);
   dict_write_uint32(iter,KEY_SAMPLE_FREQ,(uint32_t)sampleFreq);
   dict_write_uint32(iter,KEY_FREQ_CUTOFF,(uint32_t)freqCutoff);
   dict_write_uint32(iter,KEY_DATA_UPDATE_PERIOD,(uint32_t)dataUpdatePeriod);
@@ -235,17 +638,18 @@ void sendSettings() {
   dict_write_uint32(iter,KEY_ALARM_TIME,(uint32_t)alarmTime);
   dict_write_uint32(iter,KEY_ALARM_THRESH,(uint32_t)alarmThresh);
   dict_write_uint32(iter,KEY_ALARM_RATIO_THRESH,(uint32_t)alarmRatioThresh);
+  if (nRois>0)
+    dict_write_data(iter,KEY_ROI_LIST,(uint8_t*)roiFreqs,
+		    nRois*2*sizeof(roiFreqs[0]));
   BatteryChargeState charge_state = battery_state_service_peek();
   dict_write_uint8(iter,KEY_BATTERY_PC,(uint8_t)charge_state.charge_percent);
   dict_write_uint32(iter,KEY_FALL_ACTIVE,(uint32_t)fallActive);
   dict_write_uint32(iter,KEY_FALL_THRESH_MIN,(uint32_t)fallThreshMin);
   dict_write_uint32(iter,KEY_FALL_THRESH_MAX,(uint32_t)fallThreshMax);
   dict_write_uint32(iter,KEY_FALL_WINDOW,(uint32_t)fallWindow);
+  dict_write_uint32(iter,KEY_FALL_STILL_TIME,(uint32_t)fallStillTime);
   dict_write_uint32(iter,KEY_MUTE_PERIOD,(uint32_t)mutePeriod);
   dict_write_uint32(iter,KEY_MAN_ALARM_PERIOD,(uint32_t)manAlarmPeriod);
-
-  app_message_outbox_send();
-
 }
 
 
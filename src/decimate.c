@@ -0,0 +1,102 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "decimate.h"
+
+// Kaiser windowed sinc low pass filters (beta=4.5), cut off 12.5 Hz,
+// coefficients sum to 2^DECIM_COEFF_BITS for unity gain at DC.
+// The filters are symmetric, so only the first half of each is stored.
+// 100 Hz -> 25 Hz (64 taps)
+static const int16_t decimTaps4[32] = {
+  -7, -24, -32, -17, 22, 65, 79, 40,
+  -47, -135, -159, -77, 89, 248, 286, 136,
+  -155, -428, -489, -231, 265, 733, 845, 406,
+  -476, -1363, -1651, -853, 1114, 3811, 6403, 7986
+};
+// 50 Hz -> 25 Hz (32 taps)
+static const int16_t decimTaps2[16] = {
+  -27, -51, 83, 126, -182, -253, 344, 458,
+  -603, -790, 1039, 1384, -1905, -2804, 4831, 14734
+};
+
+int decim_init(struct decimator *d, int factor) {
+  int ok = 1;
+  switch (factor) {
+  case 4:
+    d->taps = decimTaps4;
+    d->nTaps = 2*sizeof(decimTaps4)/sizeof(decimTaps4[0]);
+    break;
+  case 2:
+    d->taps = decimTaps2;
+    d->nTaps = 2*sizeof(decimTaps2)/sizeof(decimTaps2[0]);
+    break;
+  default:
+    ok = (factor==1);
+    factor = 1;
+    d->taps = 0;
+    d->nTaps = 0;
+  }
+  d->factor = factor;
+  d->pos = 0;
+  d->phase = 0;
+  d->primed = 0;
+  return ok;
+}
+
+int decim_push(struct decimator *d, int32_t x, int32_t *y) {
+  int i;
+  int32_t sum;
+  const int16_t *h;
+
+  if (d->factor==1) {
+    *y = x;
+    return 1;
+  }
+  // Fill the history with the first sample so that the output does not
+  // start with a step from zero.
+  if (!d->primed) {
+    for (i=0;i<2*d->nTaps;i++) d->hist[i] = (int16_t)x;
+    d->primed = 1;
+  }
+  d->hist[d->pos] = (int16_t)x;
+  d->hist[d->pos+d->nTaps] = (int16_t)x;
+  d->pos++;
+  if (d->pos>=d->nTaps) d->pos = 0;
+
+  d->phase++;
+  if (d->phase<d->factor) return 0;
+  d->phase = 0;
+
+  // hist[pos] is the oldest sample, hist[pos+nTaps-1] the newest.
+  // The filters are symmetric, so the samples that share a tap are added
+  // first, halving the number of multiplies.  The sum of the magnitudes of
+  // the stored taps is less than 2^15 and each pair of samples less than
+  // 2^16, so the sum of the products cannot overflow.
+  h = &d->hist[d->pos];
+  sum = 0;
+  for (i=0;i<d->nTaps/2;i++)
+    sum += d->taps[i]*(h[i] + h[d->nTaps-1-i]);
+  *y = (sum + (1<<(DECIM_COEFF_BITS-1))) >> DECIM_COEFF_BITS;
+  return 1;
+}
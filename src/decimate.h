@@ -0,0 +1,64 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef __DECIMATE_H__
+#define __DECIMATE_H__
+
+#include <stdint.h>
+
+/*
+ * Anti-aliasing decimator - low pass FIR filter followed by keeping one
+ * sample in every factor, used to reduce the accelerometer data to 25 Hz
+ * before it is analysed.
+ * Does not depend on the Pebble SDK so it can be tested on a PC.
+ *
+ * Only the samples that are kept are calculated (polyphase form), and the
+ * filters are symmetric, so the cost is nTaps/2 multiplies per output
+ * sample.
+ * The filters pass 0-10 Hz (within 0.1 dB) and attenuate everything that
+ * would alias into 0-10 Hz (15 Hz and above) by more than 55 dB.
+ */
+#define DECIM_TAPS_MAX 64     // length of the longest filter.
+#define DECIM_COEFF_BITS 15   // fractional bits of filter coefficients.
+
+struct decimator {
+  int factor;                 // keep one sample in factor (1, 2 or 4).
+  int nTaps;                  // number of filter coefficients.
+  const int16_t *taps;        // first half of the filter coefficients.
+  int16_t hist[2*DECIM_TAPS_MAX]; // input history, stored twice so the
+                              // latest nTaps samples are contiguous.
+  int pos;                    // position of the oldest sample in hist.
+  int phase;                  // number of samples since the last output.
+  int primed;                 // history has been filled with real data.
+};
+
+// Set up the decimator - returns 0 if factor is not supported, in which
+// case the data is passed through unchanged (factor 1).
+int decim_init(struct decimator *d, int factor);
+
+// Add a sample (|x| < 2^15) - returns 1 and sets *y if an output sample
+// is ready.
+int decim_push(struct decimator *d, int32_t x, int32_t *y);
+
+#endif
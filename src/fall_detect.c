@@ -0,0 +1,111 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "fall_detect.h"
+
+void fall_init(struct fall_detector *fd, int threshMin, int threshMax,
+	       int window, int stillTol, int stillSamp, int timeoutSamp) {
+  fd->threshMin = threshMin;
+  fd->threshMax = threshMax;
+  fd->window = (window<1) ? 1 : window;
+  fd->stillTol = stillTol;
+  fd->stillSamp = stillSamp;
+  fd->timeoutSamp = timeoutSamp;
+  fd->state = FALL_STATE_IDLE;
+}
+
+/*********************************************
+ * Returns n samples at oldFreq converted to samples at newFreq.
+ */
+static int scale_samples(int n, int oldFreq, int newFreq) {
+  return (int)((int64_t)n*newFreq/oldFreq);
+}
+
+void fall_resume(struct fall_detector *fd, const struct fall_detector *old,
+		 int oldFreq, int newFreq) {
+  if ((oldFreq<=0) || (newFreq<=0)) return;
+  fd->state = old->state;
+  fd->sinceFree = scale_samples(old->sinceFree,oldFreq,newFreq);
+  fd->timer = scale_samples(old->timer,oldFreq,newFreq);
+  fd->stillCount = scale_samples(old->stillCount,oldFreq,newFreq);
+  fd->stillMin = old->stillMin;
+  fd->stillMax = old->stillMax;
+}
+
+/*********************************************
+ * Start looking for stillness at sample acc.
+ */
+static void still_reset(struct fall_detector *fd, int16_t acc) {
+  fd->stillCount = 0;
+  fd->stillMin = acc;
+  fd->stillMax = acc;
+}
+
+int fall_update(struct fall_detector *fd, int16_t acc) {
+  switch (fd->state) {
+  case FALL_STATE_IDLE:
+    if (acc<fd->threshMin) {
+      fd->state = FALL_STATE_FREEFALL;
+      fd->sinceFree = 0;
+    }
+    break;
+  case FALL_STATE_FREEFALL:
+    fd->sinceFree++;
+    if (acc<fd->threshMin) {
+      // Still falling - the window starts again from this sample.
+      fd->sinceFree = 0;
+    } else if (fd->sinceFree>=fd->window) {
+      // The free fall has left the window without an impact.
+      fd->state = FALL_STATE_IDLE;
+    } else if (acc>fd->threshMax) {
+      if (fd->stillSamp<=0) {
+	fd->state = FALL_STATE_IDLE;
+	return 1;
+      }
+      fd->state = FALL_STATE_IMPACT;
+      fd->timer = 0;
+      still_reset(fd,acc);
+    }
+    break;
+  case FALL_STATE_IMPACT:
+    fd->timer++;
+    if (acc<fd->stillMin) fd->stillMin = acc;
+    if (acc>fd->stillMax) fd->stillMax = acc;
+    if (fd->stillMax-fd->stillMin>fd->stillTol) {
+      // Still moving - give up if it has been too long since the impact,
+      // otherwise start timing the still period again from this sample.
+      // A new free fall is needed before the next impact is accepted.
+      if (fd->timer>fd->timeoutSamp) {
+	fd->state = FALL_STATE_IDLE;
+	break;
+      }
+      still_reset(fd,acc);
+    } else if (++fd->stillCount>=fd->stillSamp) {
+      fd->state = FALL_STATE_IDLE;
+      return 1;
+    }
+    break;
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef __FALL_DETECT_H__
+#define __FALL_DETECT_H__
+
+#include <stdint.h>
+
+/*
+ * Streaming fall detector, updated with each accelerometer sample.
+ * Does not depend on the Pebble SDK so it can be tested on a PC.
+ *
+ * A fall is a free fall (acceleration below threshMin) followed by an
+ * impact (acceleration above threshMax) less than window samples later,
+ * optionally followed by the wearer lying still - the acceleration
+ * staying within a range of stillTol for stillSamp samples, starting
+ * within timeoutSamp samples of the impact.   If stillSamp is zero the
+ * fall is reported at the impact.
+ * Only the number of samples since the last free fall sample is needed to
+ * know if the free fall is still within the window, so the cost and
+ * memory are the same for any window length.
+ */
+#define FALL_STATE_IDLE 0     // waiting for free fall.
+#define FALL_STATE_FREEFALL 1 // free fall seen - waiting for impact.
+#define FALL_STATE_IMPACT 2   // impact seen - waiting for wearer to be still.
+
+struct fall_detector {
+  int threshMin, threshMax;   // free fall and impact thresholds.
+  int window;                 // samples allowed from free fall to impact.
+  int stillTol;               // maximum range of acceleration when still.
+  int stillSamp;              // number of samples that must be still.
+  int timeoutSamp;            // time allowed after impact to become still.
+  int state;
+  int sinceFree;              // samples since the last free fall sample.
+  int timer;                  // samples since impact.
+  int stillCount;             // number of still samples so far.
+  int16_t stillMin, stillMax; // range of acceleration while still.
+};
+
+void fall_init(struct fall_detector *fd, int threshMin, int threshMax,
+	       int window, int stillTol, int stillSamp, int timeoutSamp);
+
+// Carry on with the fall in progress in old, which was sampled at oldFreq,
+// in fd, which has been set up with fall_init() for newFreq - the counts of
+// samples are scaled to the new rate.
+void fall_resume(struct fall_detector *fd, const struct fall_detector *old,
+		 int oldFreq, int newFreq);
+
+// Add a sample - returns 1 if a fall has just been detected, otherwise 0.
+int fall_update(struct fall_detector *fd, int16_t acc);
+
+#endif
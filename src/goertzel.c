@@ -0,0 +1,62 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "goertzel.h"
+
+/*********************************************
+ * Run the Goertzel recurrence
+ *    s[n] = x[n] + 2cos(w)s[n-1] - s[n-2]
+ * over count samples of the window.
+ */
+void goertzel_run(const int16_t *buf, int n, int pos, int count,
+		  int32_t mean, int32_t cosQ30, int32_t *s1, int32_t *s2) {
+  int32_t s0, t1 = *s1, t2 = *s2;
+  int end = pos + count;
+  int i;
+  // Two passes to avoid testing for wrap around on every sample.
+  for (i=pos;(i<end)&&(i<n);i++) {
+    s0 = buf[i] - mean + (int32_t)(((int64_t)cosQ30*t1 + (1<<28))>>29) - t2;
+    t2 = t1;
+    t1 = s0;
+  }
+  for (i=0;i<end-n;i++) {
+    s0 = buf[i] - mean + (int32_t)(((int64_t)cosQ30*t1 + (1<<28))>>29) - t2;
+    t2 = t1;
+    t1 = s0;
+  }
+  *s1 = t1;
+  *s2 = t2;
+}
+
+/*********************************************
+ * Once the whole window has been run through the filter
+ *    X = s[n-1] - exp(-iw)s[n-2]
+ * The magnitude of X is the magnitude of DFT bin k (the phase is
+ * referred to the end of the window rather than the start).
+ */
+void goertzel_result(int32_t s1, int32_t s2, int32_t cosQ30, int32_t sinQ30,
+		     int32_t *re, int32_t *im) {
+  *re = s1 - (int32_t)(((int64_t)cosQ30*s2 + (1<<29))>>30);
+  *im = (int32_t)(((int64_t)sinQ30*s2 + (1<<29))>>30);
+}
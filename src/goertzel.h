@@ -0,0 +1,55 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef __GOERTZEL_H__
+#define __GOERTZEL_H__
+
+#include <stdint.h>
+
+/*
+ * Integer Goertzel filter, used to calculate individual DFT bins of a
+ * window of data held in a circular buffer.
+ * Does not depend on the Pebble SDK so it can be tested on a PC.
+ *
+ * The window is the n samples buf[start], buf[start+1]...buf[n-1],
+ * buf[0]...buf[start-1] (ie. the buffer is exactly one window long).
+ * It can be run through the filter a few samples at a time, so that the
+ * work can be split up into short slices.
+ */
+
+// Runs the filter for one DFT bin over count samples of the window,
+// starting at buf[pos] (wrapping round at buf[n-1]), with mean removed.
+// cosQ30 is cos(2*pi*k/n) for bin k as a Q30 fixed point value.  *s1 and
+// *s2 hold the filter state between calls, and must be zero at the start
+// of the window.
+void goertzel_run(const int16_t *buf, int n, int pos, int count,
+		  int32_t mean, int32_t cosQ30, int32_t *s1, int32_t *s2);
+
+// Calculates the DFT bin from the filter state once the whole window has
+// been run through, where sinQ30 is sin(2*pi*k/n).   The un-scaled complex
+// result is returned in *re and *im.
+void goertzel_result(int32_t s1, int32_t s2, int32_t cosQ30, int32_t sinQ30,
+		     int32_t *re, int32_t *im);
+
+#endif
@@ -34,6 +34,13 @@ int sampleFreq;      // Sampling frequency in Hz (must be one of 10,25,50 or 100
 int freqCutoff;      // Frequency above which movement is ignored.
 int nFreqCutoff;     // Bin number of cutoff frequency.
 int samplePeriod;    // Sample period in seconds
+int analysisPeriod;  // Period between analyses of the rolling buffer (sec)
+int analysisSlice;   // Time (ms) of analysis to do before yielding
+int motionFloor;     // Spectrum power below which analysis is skipped.
+int adaptiveRate;    // ROI power below which sampling frequency is reduced
+int decimate;        // Reduce the data to DECIMATE_FREQ before analysis
+int rawFormat;       // Format of raw mode data (RAW_FORMAT_MAG or _XYZ)
+int resultsFormat;   // Format of results (RESULTS_FORMAT_KEYS or _PACKED)
 int nSamp;           // number of samples in sampling period
                      //  (rounded up to a power of 2)
 int fftBits;         // size of fft data array (nSamp = 2^(fftBits))
@@ -50,13 +57,17 @@ int alarmThresh;     // Alarm threshold (average power of spectrum within
 int alarmRatioThresh;
 int nMax = 0;
 int nMin = 0;
-int nMins[4];
-int nMaxs[4];
+int nRois = 0;
+uint16_t roiFreqs[2*ROI_MAX];
+int nRoiBands = 4;
+int nMins[ROI_MAX];
+int nMaxs[ROI_MAX];
 
 int fallActive = 0;     // fall detection active (0=inactive)
 int fallThreshMin = 0;  // fall detection minimum (lower) threshold (milli-g)
 int fallThreshMax = 0;  // fall detection maximum (upper) threshold (milli-g)
 int fallWindow = 0;     // fall detection window (milli-seconds).
+int fallStillTime = 0;  // time still needed to confirm a fall (milli-seconds).
 int fallDetected = 0;   // flag to say if fall is detected (<>0 is fall)
 
 int isManAlarm = 0;     // flag to say if a manual alarm has been raised.
@@ -77,11 +88,16 @@ AccelData latestAccelData;  // Latest accelerometer readings received.
 int maxVal = 0;       // Peak amplitude in spectrum.
 int maxLoc = 0;       // Location in output array of peak.
 int maxFreq = 0;      // Frequency corresponding to peak location.
+int peakFreq = 0;     // Interpolated peak frequency (mHz).
+int specCentroid = 0; // Spectral centroid (mHz).
+int roiPeakRatio = 0; // 10 x peak to mean power ratio within ROI.
 long specPower = 0;   // Average power of whole spectrum.
 long roiPower = 0;    // Average power of spectrum in region of interest
-long roiPowers[4];
+long roiPowers[ROI_MAX];
 int roiRatio = 0;     // 10xroiPower/specPower
-int roiRatios[4];
+int roiRatios[ROI_MAX];
+long axisRoiPowers[3];  // ROI power of each axis (x,y,z).
+long axisSpecPowers[3]; // Spectrum power of each axis.
 int freqRes = 0;      // Actually 1000 x frequency resolution
 
 int alarmState = 0;    // 0 = OK, 1 = WARNING, 2 = ALARM
@@ -96,7 +112,69 @@ int alarmCount = 0;    // number of seconds that we have been in an alarm state.
 
 
 /************************************************************************
- * clock_tick_handler() - Analyse data and update display.
+ * process_alarm_state() - Report the result of an analysis.
+ * Called by analysis_timer_callback() once alarm_check() has set
+ * alarmState.  Adds any fall, manual alarm or mute state, displays the
+ * alarm message and sends the data to the phone if there is an alarm
+ * condition or the state has changed.
+ */
+void process_alarm_state() {
+  static char s_alarm_msg_buffer[16];
+  static int lastAlarmState = 0;
+
+  // If no seizure detected, modify alarmState to reflect potential fall
+  // detection (fallDetected is set by accel_handler()).
+  if ((alarmState == ALARM_STATE_OK) && (fallDetected==1))
+    alarmState = ALARM_STATE_FALL;
+  
+  //  Display alarm message on screen.
+  if (alarmState == ALARM_STATE_OK) {
+    text_layer_set_text(alarm_layer, "OK");
+  }
+  if (alarmState == ALARM_STATE_WARN) {
+    //vibes_short_pulse();
+    snprintf(s_alarm_msg_buffer,sizeof(s_alarm_msg_buffer),
+	     "WARNING %d",alarmRoi);
+    text_layer_set_text(alarm_layer, s_alarm_msg_buffer);
+  }
+  if (alarmState == ALARM_STATE_ALARM) {
+    //vibes_long_pulse();
+    snprintf(s_alarm_msg_buffer,sizeof(s_alarm_msg_buffer),
+	     "* ALARM %d *",alarmRoi);
+    text_layer_set_text(alarm_layer, s_alarm_msg_buffer);
+  }
+  if (alarmState == ALARM_STATE_FALL) {
+    //vibes_long_pulse();
+    text_layer_set_text(alarm_layer, "** FALL **");
+  }
+  if (isManAlarm) {
+    alarmState = ALARM_STATE_MAN_ALARM;
+    text_layer_set_text(alarm_layer, "** MAN ALARM **");
+  }
+  if (isMuted) {
+    alarmState = ALARM_STATE_MUTE;
+    text_layer_set_text(alarm_layer, "** MUTE **");
+  }    
+  
+  // Send data to phone if we have an alarm condition.
+  // or if alarm state has changed from last time.
+  if ((alarmState != ALARM_STATE_OK && !isMuted) ||
+      (alarmState != lastAlarmState)) {
+    sendSdData();
+  }
+  // and the whole spectrum when a warning or alarm is first raised.
+  if (((alarmState == ALARM_STATE_WARN) || (alarmState == ALARM_STATE_ALARM))
+      && (lastAlarmState != ALARM_STATE_WARN)
+      && (lastAlarmState != ALARM_STATE_ALARM)) {
+    sendFftSpec();
+  }
+  lastAlarmState = alarmState;
+  fallDetected = 0;  // the fall has been reported.
+}
+
+
+/************************************************************************
+ * clock_tick_handler() - Update display.
  * Updates the text layer clock_layer to show current time.
  * This function is the handler for tick events and is called every 
  * second.
@@ -104,9 +182,7 @@ int alarmCount = 0;    // number of seconds that we have been in an alarm state.
 static void clock_tick_handler(struct tm *tick_time, TimeUnits units_changed) {
   static char s_batt_buffer[16];
   static char s_time_buffer[16];
-  static char s_alarm_msg_buffer[16];
   static int dataUpdateCount = 0;
-  static int lastAlarmState = 0;
 
   if (isManAlarm) {
     APP_LOG(APP_LOG_LEVEL_DEBUG,"Manual Alarm - manAlarmTime=%d, manAlarmPeriod=%d",
@@ -132,56 +208,6 @@ static void clock_tick_handler(struct tm *tick_time, TimeUnits units_changed) {
   }
   
   
-  // Do FFT analysis if we have filled the buffer with data.
-  if (accDataFull) {
-    do_analysis();
-    if (fallActive) check_fall();  // sets fallDetected global variable.
-    // Check the alarm state, and set the global alarmState variable.
-    alarm_check();
-    
-    // If no seizure detected, modify alarmState to reflect potential fall
-    // detection
-    if ((alarmState == ALARM_STATE_OK) && (fallDetected==1))
-      alarmState = ALARM_STATE_FALL;
-    
-    //  Display alarm message on screen.
-    if (alarmState == ALARM_STATE_OK) {
-      text_layer_set_text(alarm_layer, "OK");
-    }
-    if (alarmState == ALARM_STATE_WARN) {
-      //vibes_short_pulse();
-      snprintf(s_alarm_msg_buffer,sizeof(s_alarm_msg_buffer),
-	       "WARNING %d",alarmRoi);
-      text_layer_set_text(alarm_layer, s_alarm_msg_buffer);
-    }
-    if (alarmState == ALARM_STATE_ALARM) {
-      //vibes_long_pulse();
-      snprintf(s_alarm_msg_buffer,sizeof(s_alarm_msg_buffer),
-	       "* ALARM %d *",alarmRoi);
-      text_layer_set_text(alarm_layer, s_alarm_msg_buffer);
-    }
-    if (alarmState == ALARM_STATE_FALL) {
-      //vibes_long_pulse();
-      text_layer_set_text(alarm_layer, "** FALL **");
-    }
-    if (isManAlarm) {
-      alarmState = ALARM_STATE_MAN_ALARM;
-      text_layer_set_text(alarm_layer, "** MAN ALARM **");
-    }
-    if (isMuted) {
-      alarmState = ALARM_STATE_MUTE;
-      text_layer_set_text(alarm_layer, "** MUTE **");
-    }    
-    
-    // Send data to phone if we have an alarm condition.
-    // or if alarm state has changed from last time.
-    if ((alarmState != ALARM_STATE_OK && !isMuted) ||
-	(alarmState != lastAlarmState)) {
-      sendSdData();
-    }
-    lastAlarmState = alarmState;
-  }
-  
   // See if it is time to send data to the phone.
   dataUpdateCount++;
   if (dataUpdateCount>=dataUpdatePeriod) {
@@ -228,7 +254,6 @@ void draw_spec(Layer *sl, GContext *ctx) {
   for (i=0;i<bounds.size.w-1;i++) {
     p0 = GPoint(i,bounds.size.h-1);
     if (i<=nFreqCutoff) {
-      //h = bounds.size.h*getAmpl(i)/1000.;
       h = bounds.size.h * fftResults[i]/1000.;
       //APP_LOG(APP_LOG_LEVEL_DEBUG,"draw spectrum - i = %d, h=%d",i,h);
     }
@@ -426,6 +451,27 @@ static void init(void) {
   samplePeriod = SAMPLE_PERIOD_DEFAULT;
   if (persist_exists(KEY_SAMPLE_PERIOD))
     samplePeriod = persist_read_int(KEY_SAMPLE_PERIOD);
+  analysisPeriod = ANALYSIS_PERIOD_DEFAULT;
+  if (persist_exists(KEY_ANALYSIS_PERIOD))
+    analysisPeriod = persist_read_int(KEY_ANALYSIS_PERIOD);
+  analysisSlice = ANALYSIS_SLICE_DEFAULT;
+  if (persist_exists(KEY_ANALYSIS_SLICE))
+    analysisSlice = persist_read_int(KEY_ANALYSIS_SLICE);
+  motionFloor = MOTION_FLOOR_DEFAULT;
+  if (persist_exists(KEY_MOTION_FLOOR))
+    motionFloor = persist_read_int(KEY_MOTION_FLOOR);
+  adaptiveRate = ADAPTIVE_RATE_DEFAULT;
+  if (persist_exists(KEY_ADAPTIVE_RATE))
+    adaptiveRate = persist_read_int(KEY_ADAPTIVE_RATE);
+  decimate = DECIMATE_DEFAULT;
+  if (persist_exists(KEY_DECIMATE))
+    decimate = persist_read_int(KEY_DECIMATE);
+  rawFormat = RAW_FORMAT_DEFAULT;
+  if (persist_exists(KEY_RAW_FORMAT))
+    rawFormat = persist_read_int(KEY_RAW_FORMAT);
+  resultsFormat = RESULTS_FORMAT_DEFAULT;
+  if (persist_exists(KEY_RESULTS_FORMAT))
+    resultsFormat = persist_read_int(KEY_RESULTS_FORMAT);
   sampleFreq = SAMPLE_FREQ_DEFAULT;
   if (persist_exists(KEY_SAMPLE_FREQ))
     sampleFreq = persist_read_int(KEY_SAMPLE_FREQ);
@@ -459,6 +505,11 @@ static void init(void) {
   alarmRatioThresh = ALARM_RATIO_THRESH_DEFAULT;
   if (persist_exists(KEY_ALARM_RATIO_THRESH))
     alarmRatioThresh = persist_read_int(KEY_ALARM_RATIO_THRESH);
+  nRois = 0;
+  if (persist_exists(KEY_ROI_LIST))
+    nRois = persist_read_data(KEY_ROI_LIST,roiFreqs,sizeof(roiFreqs))
+      / (2*sizeof(roiFreqs[0]));
+  if (nRois<0) nRois = 0;
 
   // Fall detection settings
   fallActive = FALL_ACTIVE_DEFAULT;
@@ -473,6 +524,9 @@ static void init(void) {
   fallWindow = FALL_WINDOW_DEFAULT;
   if (persist_exists(KEY_FALL_WINDOW))
     fallWindow = persist_read_int(KEY_FALL_WINDOW);
+  fallStillTime = FALL_STILL_TIME_DEFAULT;
+  if (persist_exists(KEY_FALL_STILL_TIME))
+    fallStillTime = persist_read_int(KEY_FALL_STILL_TIME);
 
   mutePeriod = MUTE_PERIOD_DEFAULT;
   if (persist_exists(KEY_MUTE_PERIOD))
@@ -516,6 +570,13 @@ static void deinit(void) {
   persist_write_int(KEY_DEBUG,debug);
   persist_write_int(KEY_DISPLAY_SPECTRUM,displaySpectrum);
   persist_write_int(KEY_SAMPLE_PERIOD,samplePeriod);
+  persist_write_int(KEY_ANALYSIS_PERIOD,analysisPeriod);
+  persist_write_int(KEY_ANALYSIS_SLICE,analysisSlice);
+  persist_write_int(KEY_MOTION_FLOOR,motionFloor);
+  persist_write_int(KEY_ADAPTIVE_RATE,adaptiveRate);
+  persist_write_int(KEY_DECIMATE,decimate);
+  persist_write_int(KEY_RAW_FORMAT,rawFormat);
+  persist_write_int(KEY_RESULTS_FORMAT,resultsFormat);
   persist_write_int(KEY_SAMPLE_FREQ,sampleFreq);
   persist_write_int(KEY_FREQ_CUTOFF,freqCutoff);
   persist_write_int(KEY_DATA_UPDATE_PERIOD,dataUpdatePeriod);
@@ -526,11 +587,16 @@ static void deinit(void) {
   persist_write_int(KEY_ALARM_TIME,alarmTime);
   persist_write_int(KEY_ALARM_THRESH,alarmThresh);
   persist_write_int(KEY_ALARM_RATIO_THRESH,alarmRatioThresh);
+  if (nRois>0)
+    persist_write_data(KEY_ROI_LIST,roiFreqs,nRois*2*sizeof(roiFreqs[0]));
+  else
+    persist_delete(KEY_ROI_LIST);
 
   persist_write_int(KEY_FALL_ACTIVE,fallActive);
   persist_write_int(KEY_FALL_THRESH_MIN,fallThreshMin);
   persist_write_int(KEY_FALL_THRESH_MAX,fallThreshMax);
   persist_write_int(KEY_FALL_WINDOW,fallWindow);
+  persist_write_int(KEY_FALL_STILL_TIME,fallStillTime);
 
   persist_write_int(KEY_MUTE_PERIOD,mutePeriod);
   persist_write_int(KEY_MAN_ALARM_PERIOD,manAlarmPeriod);
@@ -28,6 +28,16 @@
 /* COMMS CONFIGURATION */
 #define OUTBOX_SIZE 512   // App Message Outpbox size in bytes
 #define INBOX_SIZE 512    // App Message Inbox size in bytes
+#define RAW_MSG_SAMPLES 100  // Raw samples sent in each message (4 batches
+                          // of accelerometer data - 400 bytes, leaving room
+                          // in the outbox for the other keys).
+#define RAW_RING_SAMPLES 300 // Raw samples (x,y,z) held while waiting for the
+                          // outbox (3 messages) - batches arriving when
+                          // it is full are dropped.
+#define SPEC_MSG_BINS 200    // Spectrum bins sent in each message (400 bytes).
+#define COMMS_RETRY_MS 250   // Delay before resending a failed message -
+                          // doubled after each failure.
+#define COMMS_RETRY_MAX 5    // Failed attempts before a message is abandoned.
 
 #include "pebble_process_info.h"
 extern const PebbleProcessInfo __pbl_app_info;
@@ -41,8 +51,11 @@ extern const PebbleProcessInfo __pbl_app_info;
 // default values of seizure detector settings
 #define SAMPLE_PERIOD_DEFAULT 5  // sec
 #define SAMPLE_FREQ_DEFAULT 100  // Hz
+#ifndef NSAMP_MAX
 #define NSAMP_MAX 512       // maximum number of samples of accelerometer
-                            // data to collect (used to size arrays).
+                            // data to collect (used to size arrays) -
+                            // set for each platform by wscript.
+#endif
 #define FREQ_CUTOFF_DEFAULT 12 // Hz - frequency above which movement is ignored.
 #define DATA_UPDATE_PERIOD_DEFAULT 20 // number of seconds between sending
                             //data to phone
@@ -50,7 +63,38 @@ extern const PebbleProcessInfo __pbl_app_info;
                             // condition is detected.
 #define SD_MODE_DEFAULT        0  // FFT Mode
 #define SAMPLE_FREQ_DEFAULT    100 // Hz
-#define ANALYSIS_PERIOD_DEFAULT 5  // seconds
+#define ANALYSIS_PERIOD_DEFAULT 5  // seconds between analyses of the
+                            // rolling buffer (the analysis 'hop').  A value
+                            // less than SAMPLE_PERIOD gives overlapping windows
+                            // but each analysis in an alarm condition sends
+                            // data to the phone, so a shorter period costs
+                            // more radio time and battery.
+#define ANALYSIS_SLICE_DEFAULT 5  // ms of analysis to do before letting
+                            // the watch handle other events (0 = do the
+                            // whole analysis at once).
+#define MOTION_FLOOR_DEFAULT 0  // Spectrum power below which a window
+                            // is treated as still and no spectrum is
+                            // calculated (0 = off - always calculate
+                            // spectrum), if its ROI power could not exceed
+                            // ALARM_THRESH.  Gated windows report a flat
+                            // spectrum estimated from their total power
+                            // rather than the measured one, so it is off
+                            // by default.
+#define ADAPTIVE_RATE_DEFAULT 0  // ROI power below which the sampling
+                            // frequency is reduced (0 = always sample at
+                            // SAMPLE_FREQ).
+#define ADAPTIVE_FREQ_LOW 25     // Hz - reduced sampling frequency.
+#define ADAPTIVE_QUIET_TIME 60   // sec below ADAPTIVE_RATE before the
+                            // sampling frequency is reduced.
+#define DECIMATE_DEFAULT 0       // Reduce the data to DECIMATE_FREQ before
+                            // it is analysed (0 = analyse at SAMPLE_FREQ).
+                            // Off by default because it changes the
+                            // spectrum power, and so the thresholds.
+#define DECIMATE_FREQ 25         // Hz - sampling frequency after decimation.
+#define RAW_FORMAT_DEFAULT 0     // Format of raw mode data (RAW_FORMAT_MAG).
+#define RESULTS_FORMAT_DEFAULT 0 // Format of results (RESULTS_FORMAT_KEYS).
+#define ROI_MAX 8                // Maximum number of regions of interest
+                            // checked in multi-ROI mode.
 #define ALARM_FREQ_MIN_DEFAULT 3  // Hz
 #define ALARM_FREQ_MAX_DEFAULT 10 // Hz
 #define WARN_TIME_DEFAULT      5 // sec
@@ -66,7 +110,12 @@ extern const PebbleProcessInfo __pbl_app_info;
 #define FALL_ACTIVE_DEFAULT 0  // 0 = fall detection inactive.
 #define FALL_THRESH_MIN_DEFAULT 200 // milli-g
 #define FALL_THRESH_MAX_DEFAULT 800 // milli-g
-#define FALL_WINDOW_DEFAULT     1500 // milli-secs
+#define FALL_WINDOW_DEFAULT     1500 // milli-secs from free fall to impact.
+#define FALL_STILL_TIME_DEFAULT 0 // milli-secs still needed to confirm a
+                                  // fall (0 = report fall at impact).
+#define FALL_STILL_TOL    300  // milli-g - range of acceleration while lying
+                               // still after a fall.
+#define FALL_STILL_TIMEOUT 5000 // milli-secs after impact to become still.
 
 // default mute time
 #define MUTE_PERIOD_DEFAULT 300  // number of seconds to mute alarm following
@@ -125,12 +174,47 @@ extern const PebbleProcessInfo __pbl_app_info;
 #define KEY_VERSION_MINOR 36
 #define KEY_FREQ_CUTOFF 37
 #define KEY_ALARM_ROI 38
+#define KEY_ANALYSIS_PERIOD 39
+#define KEY_NUM_DROPPED 40   // Number of samples dropped before analysis.
+#define KEY_ANALYSIS_LATENCY 41  // Time from data ready to alarm verdict (ms)
+#define KEY_ANALYSIS_SLICE 42
+#define KEY_MAX_BLOCK_TIME 43    // Longest analysis time slice (ms)
+#define KEY_MOTION_FLOOR 44
+#define KEY_NUM_SKIPPED 45       // Number of windows skipped by motion gate.
+#define KEY_ADAPTIVE_RATE 46
+#define KEY_CUR_SAMPLE_FREQ 47   // Sampling frequency in use (Hz)
+#define KEY_DECIMATE 48
+#define KEY_ROI_LIST 49          // Multi-ROI bounds - pairs of uint16 (mHz)
+#define KEY_PEAK_FREQ 50         // Interpolated peak frequency (mHz)
+#define KEY_SPEC_CENTROID 51     // Spectral centroid (mHz)
+#define KEY_ROI_PEAK_RATIO 52    // 10 x ROI peak to mean power ratio
+#define KEY_AXIS_ROI_POWERS 53   // ROI power of each axis (x,y,z) - int32s
+#define KEY_AXIS_SPEC_POWERS 54  // Spectrum power of each axis - int32s
+#define KEY_NUM_RAW_DROPPED 55   // Number of raw data batches dropped.
+#define KEY_RAW_FORMAT 56
+#define KEY_COMMS_QUEUED 57      // Messages waiting to be sent to the phone.
+#define KEY_COMMS_DROPPED 58     // Messages abandoned after COMMS_RETRY_MAX tries.
+#define KEY_COMMS_RETRIES 59     // Messages resent after a failure.
+#define KEY_COMMS_COALESCED 60   // Messages replaced by a newer one.
+#define KEY_RESULTS_PACKED 61    // Results record (respack.h) - bytes.
+#define KEY_RESULTS_FORMAT 62
+#define KEY_FREQ_RES 63          // 1000 x frequency resolution of spectrum.
+#define KEY_FALL_STILL_TIME 64
 
 // Values of the KEY_DATA_TYPE entry in a message
 #define DATA_TYPE_RESULTS 1   // Analysis Results
 #define DATA_TYPE_SETTINGS 2  // Settings
 #define DATA_TYPE_SPEC 3      // FFT Spectrum (or part of a spectrum)
 #define DATA_TYPE_RAW 4       // Raw accelerometer data.
+#define DATA_TYPE_RAW_XYZ 5   // Raw x,y,z accelerometer data (rawpack.h).
+
+// Values of the RAW_FORMAT setting
+#define RAW_FORMAT_MAG 0  // x^2+y^2+z^2 of each sample, as int32 (DATA_TYPE_RAW)
+#define RAW_FORMAT_XYZ 1  // x, y and z delta encoded (DATA_TYPE_RAW_XYZ)
+
+// Values of the RESULTS_FORMAT setting
+#define RESULTS_FORMAT_KEYS 0   // a dictionary entry for each value.
+#define RESULTS_FORMAT_PACKED 1 // one KEY_RESULTS_PACKED record.
 
 // Values for ALARM_STATE
 #define ALARM_STATE_OK 0   // no alarm
@@ -146,12 +230,74 @@ extern const PebbleProcessInfo __pbl_app_info;
 #define SD_MODE_RAW 1     // Send raw, unprocessed data to the phone.
 #define SD_MODE_FILTER 2  // Use digital filter rather than FFT.
 #define SD_MODE_FFT_MULTI_ROI 3  // Use multiple ROI FFT analysis.
+#define SD_MODE_SDFT 4    // Sliding DFT updated as each sample arrives.
+#define SD_MODE_GOERTZEL 5 // Goertzel filters for only the bins up to
+                           // 10 Hz or the top of the ROI - experimental:
+                           // 3-15 times the CPU time of SD_MODE_FFT
+                           // (tests/goertzel_bench.c).
+#define SD_MODE_FFT_AXES 6 // FFT of each accelerometer axis.
+
+// Per axis analysis (SD_MODE_FFT_AXES) needs a buffer and decimator for
+// each axis - wscript turns it off on aplite, where it falls back to
+// SD_MODE_FFT.
+#ifndef AXIS_ANALYSIS
+#define AXIS_ANALYSIS 1
+#endif
+#define AXIS_PENDING_MAX 64   // y and z samples that can be held back while
+                              // the axes of a window are analysed.
+// The sliding DFT (SD_MODE_SDFT) and filter (SD_MODE_FILTER) modes are
+// also left out on aplite to save memory, and fall back to SD_MODE_FFT, as
+// are the radix-4 FFT tables (FFT_RADIX4, see SYLT-FFT/config.h) and the
+// 64 bit cumulative powers (SPEC_CUM_BITS, see spectrum.h).
+#ifndef SDFT_ANALYSIS
+#define SDFT_ANALYSIS 1
+#endif
+#ifndef FILTER_ANALYSIS
+#define FILTER_ANALYSIS 1
+#endif
+
+// Digital filter (SD_MODE_FILTER) configuration
+#define FILTER_FREQ_MIN 500   // mHz - lower edge of whole spectrum band.
+#define FILTER_TIME_CONST 1000 // ms - time constant of power integrators.
+#define FILTER_COEFF_BITS 28  // fractional bits of filter coefficients.
+#define FILTER_FRAC_BITS 8    // fractional bits of filter input/output.
+#define FILTER_ORDER 2        // number of high pass and low pass sections
+                              //  in each band pass filter.
+
+// Goertzel mode configuration
+#define GOERTZEL_STEP_SAMPLES 32 // samples run through the filters in one
+                                 // step of the analysis.
+
+// Sliding DFT configuration
+#define SDFT_NBINS_MAX (NSAMP_MAX/4+1) // maximum number of bins calculated
+#define SDFT_DAMPING_BITS 14  // damping factor r = 1-2^-SDFT_DAMPING_BITS
+
+// Steps of the (time sliced) analysis of a window of data
+#define ANALYSIS_STEP_IDLE 0     // no analysis in progress
+#define ANALYSIS_STEP_START 1    // set up and take the window of data
+#define ANALYSIS_STEP_FFT 2      // permutation and FFT butterfly stages
+#define ANALYSIS_STEP_CONVERT 3  // convert FFT output to real spectrum
+#define ANALYSIS_STEP_REDUCE 4   // calculate spectrum and ROI powers
+#define ANALYSIS_STEP_ALARM 5    // check and report the alarm state
+#define ANALYSIS_STEP_GOERTZEL 6 // run part of the window through the
+                                 // Goertzel filters
 
 /* GLOBAL VARIABLES */
 // Settings (obtained from default constants or persistent storage)
 extern int debug;            // enable or disable logging output
 extern int displaySpectrum;  // enable or disable spectrum display on watch screen.
 extern int samplePeriod;    // sample period in seconds.
+extern int analysisPeriod;  // period (in sec) between analyses of the
+                            //    rolling buffer (<= samplePeriod).
+extern int analysisSlice;   // time (in ms) of analysis to do in one go.
+extern int motionFloor;     // spectrum power below which analysis is skipped.
+extern int adaptiveRate;    // ROI power below which the sampling frequency
+                            //    is reduced (0 = off).
+extern int decimate;        // reduce data to DECIMATE_FREQ before analysis.
+extern int rawFormat;       // format of raw mode data sent to the phone.
+extern int resultsFormat;   // format of results sent to the phone.
+extern int accelFreq;       // accelerometer sampling frequency in use (Hz).
+extern int curSampleFreq;   // sampling frequency of analysed data (Hz).
 extern int sampleFreq;      // sampling frequency in Hz
                             //    (must be one of 10,25,50 or 100)
 extern int freqCutoff;      // frequency above which movement is ignored.
@@ -165,33 +311,57 @@ extern int sampleFreq;      // Sample frequency in Hz.
 extern int alarmFreqMin;    // Minimum frequency (in Hz) for analysis region of interest.
 extern int alarmFreqMax;    // Maximum frequency (in Hz) for analysis region of interest.
 extern int nMin, nMax;      // Bin number of region of interest boundaries.
-extern int nMins[4],nMaxs[4]; // Bin numbers for four regions of interest.
+extern int nRois;           // Number of ROIs in roiFreqs (0 = use the four
+                            // default ROIs derived from alarmFreqMin/Max).
+extern uint16_t roiFreqs[2*ROI_MAX]; // Multi-ROI bounds (mHz) - min,max pairs.
+extern int nRoiBands;       // Number of regions of interest being checked.
+extern int nMins[ROI_MAX],nMaxs[ROI_MAX]; // Bin numbers of the regions of
+                            // interest checked in multi-ROI mode.
 extern int warnTime;        // number of seconds above threshold to raise warning
 extern int alarmTime;       // number of seconds above threshold to raise alarm.
 extern int alarmThresh;     // Alarm threshold (average power of spectrum within
                      //       region of interest.
 extern int alarmRatioThresh; // 10x Ratio of ROI power to Spectrum power to raise alarm.
 
-extern int accDataPos;   // Position in accData of last point in time series.
-extern int accDataFull;  // Flag so we know when we have a complete buffer full
-                      // of data.
+extern int accDataPos;   // Position in accData to write the next sample
+                         // (also the oldest sample once the buffer is full).
+extern int accDataFull;  // Flag so we know when a new analysis window is
+                         // ready (buffer full and analysisPeriod elapsed).
+extern int nHop;         // number of samples between analyses.
+extern uint32_t accDataDropped; // number of samples lost before analysis.
+extern uint32_t analysisLatency; // time from data ready to alarm verdict (ms).
+extern uint32_t analysisBlockMax; // longest analysis time slice (ms).
+extern uint32_t fftSkipped; // number of windows skipped by motion gate.
+extern uint32_t rawBatchesDropped; // number of raw data batches not sent.
+extern uint32_t commsDropped; // number of messages to the phone abandoned.
+extern uint32_t commsRetries; // number of messages to the phone resent.
+extern uint32_t commsCoalesced; // number of messages replaced by newer ones.
+extern int fftSpecBusy;   // fftResults is being sent to the phone.
+extern int fftSpecDeferred; // fftResults was requested while incomplete.
+extern int fftResultsBuilding; // fftResults holds a partial spectrum.
 extern short fftResults[NSAMP_MAX/2];  // FFT results
 extern int simpleSpec[10];  // Simplified spectrum - 1 to 10 Hz bins.
 extern AccelData latestAccelData;  // Latest accelerometer readings received.
 extern int maxVal;       // Peak amplitude in spectrum.
 extern int maxLoc;       // Location in output array of peak.
-extern int maxFreq;      // Frequency corresponding to peak location.
+extern int maxFreq;      // Frequency corresponding to peak location (Hz).
+extern int peakFreq;     // Peak frequency interpolated between bins (mHz).
+extern int specCentroid; // Power weighted mean frequency of spectrum (mHz).
+extern int roiPeakRatio; // 10 x peak to mean power ratio within ROI.
 extern long specPower;   // Average power of whole spectrum.
 extern long roiPower;    // Average power of spectrum in region of interest
 extern int roiRatio;     // ratio of roiPower to specPower (x10)
-extern long roiPowers[4]; // array storing the four regions of interest powers
-extern int roiRatios[4]; // array storing the four ROI ratios.
+extern long roiPowers[ROI_MAX]; // array storing the regions of interest powers
+extern int roiRatios[ROI_MAX]; // array storing the ROI ratios.
+extern long axisRoiPowers[3];  // ROI power of each axis (SD_MODE_FFT_AXES)
+extern long axisSpecPowers[3]; // spectrum power of each axis.
 extern int freqRes;      // Actually 1000 x frequency resolution
 
 extern int fallActive;    // fall detection active (0=inactive)
 extern int fallThreshMin; // fall detection minimum (lower) threshold (milli-g)
 extern int fallThreshMax; // fall detection maximum (upper) threshold (milli-g)
 extern int fallWindow;    // fall detection window (milli-seconds).
+extern int fallStillTime; // time still after a fall (milli-seconds).
 extern int fallDetected;  // flag to say if fall is detected (<>0 is fall)
 
 extern int isManAlarm;     // flag to say if a manual alarm has been raised.
@@ -215,14 +385,16 @@ void inbox_dropped_callback(AppMessageResult reason, void *context);
 void outbox_failed_callback(DictionaryIterator *iterator, AppMessageResult reason, void *context);
 void outbox_sent_callback(DictionaryIterator *iterator, void *context);
 void sendSdData();
-void sendRawData();
+void sendRawData(AccelData *data, uint32_t num_samples);
+void sendFftSpec();
+void commsDataReset();
 void comms_init();
 
+// from pebble_sd.c
+void process_alarm_state();
+
 
 // from analysis.c
 void analysis_init();
 int alarm_check();
 void accel_handler(AccelData *data, uint32_t num_samples);
-void do_analysis();
-void check_fall();
-int getAmpl(int nBin);
@@ -0,0 +1,85 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "rawpack.h"
+
+static int put_varint(uint8_t *out, uint32_t v) {
+  int n = 0;
+  while (v>=0x80) {
+    out[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+int rawpack_encode(const int16_t *xyz, int n, uint8_t *out, int outSize,
+		   int *nBytes) {
+  int i,k,pos;
+  int32_t d;
+
+  *nBytes = 0;
+  if ((n<=0) || (outSize<RAWPACK_BASE_BYTES)) return 0;
+  for (k=0;k<3;k++) {
+    out[2*k] = (uint8_t)xyz[k];
+    out[2*k+1] = (uint8_t)((uint16_t)xyz[k]>>8);
+  }
+  pos = RAWPACK_BASE_BYTES;
+  for (i=1;i<n;i++) {
+    // Only check the space per sample rather than per byte, at the cost of
+    // leaving up to RAWPACK_SAMPLE_MAX-1 bytes unused.
+    if (pos+RAWPACK_SAMPLE_MAX>outSize) break;
+    for (k=0;k<3;k++) {
+      d = (int32_t)xyz[3*i+k] - xyz[3*(i-1)+k];
+      pos += put_varint(&out[pos],((uint32_t)d<<1) ^ (uint32_t)(d>>31));
+    }
+  }
+  *nBytes = pos;
+  return i;
+}
+
+int rawpack_decode(const uint8_t *in, int nBytes, int16_t *xyz, int nMax) {
+  int i,k,shift,pos;
+  uint32_t v;
+
+  if (nBytes<RAWPACK_BASE_BYTES) return (nBytes==0) ? 0 : -1;
+  if (nMax<1) return -1;
+  for (k=0;k<3;k++)
+    xyz[k] = (int16_t)(in[2*k] | (in[2*k+1]<<8));
+  pos = RAWPACK_BASE_BYTES;
+  for (i=1;pos<nBytes;i++) {
+    if (i>=nMax) return -1;
+    for (k=0;k<3;k++) {
+      v = 0;
+      shift = 0;
+      do {
+	if ((pos>=nBytes) || (shift>14)) return -1;
+	v |= (uint32_t)(in[pos] & 0x7f) << shift;
+	shift += 7;
+      } while (in[pos++] & 0x80);
+      xyz[3*i+k] = (int16_t)(xyz[3*(i-1)+k] + (int32_t)((v>>1) ^ -(v&1)));
+    }
+  }
+  return i;
+}
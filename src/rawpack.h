@@ -0,0 +1,59 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef __RAWPACK_H__
+#define __RAWPACK_H__
+
+#include <stdint.h>
+
+/*
+ * Compact encoding of three axis accelerometer data for raw mode, so the
+ * phone gets all three axes in fewer bytes than the single 32 bit
+ * magnitude per sample that was sent before.
+ * Does not depend on the Pebble SDK so it can be tested on a PC.
+ *
+ * A block of n samples (x,y,z interleaved, milli-g) is encoded as
+ *   - the first sample - three int16 values, little endian (the base),
+ *   - for each following sample, the change in x, y and z from the
+ *     previous sample, zig-zag mapped to an unsigned value (0,-1,1,-2,...
+ *     -> 0,1,2,3,...) and written as a varint - 7 bits per byte, least
+ *     significant first, top bit set on every byte but the last.
+ * Changes of up to +/-63 milli-g take one byte and up to +/-8191 two, so
+ * data sampled at 25-100 Hz needs 3-4 bytes per sample.  The number of
+ * samples is not stored - it is sent alongside the block.
+ */
+#define RAWPACK_BASE_BYTES 6     // size of the first sample of a block.
+#define RAWPACK_SAMPLE_MAX 9     // largest encoded size of a later sample.
+
+// Encode up to n samples from xyz into out (at most outSize bytes),
+// stopping early if the next sample might not fit.  Returns the number of
+// samples encoded and sets *nBytes to the size of the block.
+int rawpack_encode(const int16_t *xyz, int n, uint8_t *out, int outSize,
+		   int *nBytes);
+
+// Decode a block of nBytes from in into xyz (room for nMax samples).
+// Returns the number of samples decoded, or -1 if the block is corrupt.
+int rawpack_decode(const uint8_t *in, int nBytes, int16_t *xyz, int nMax);
+
+#endif
@@ -0,0 +1,130 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "respack.h"
+
+uint32_t respack_ulog(uint32_t v, int bits) {
+  uint32_t m;
+  int e = 0;
+  if (v < (1u<<bits)) return v;
+  // Find e so that v>>e has bits+1 bits, then round - which can carry into
+  // another bit.
+  while ((v>>e) >= (2u<<bits)) e++;
+  m = (uint32_t)(((uint64_t)v + (1u<<e>>1)) >> e);
+  if (m >= (2u<<bits)) {
+    m >>= 1;
+    e++;
+  }
+  // The leading bit of m is implied by the exponent.
+  return ((uint32_t)(e+1)<<bits) | (m - (1u<<bits));
+}
+
+uint32_t respack_unlog(uint32_t code, int bits) {
+  uint32_t e = code>>bits;
+  uint32_t m = code & ((1u<<bits)-1);
+  uint64_t v;
+  if (e==0) return m;
+  v = (uint64_t)(m + (1u<<bits)) << (e-1);
+  return (v>0xffffffffu) ? 0xffffffffu : (uint32_t)v;
+}
+
+static uint8_t *put16(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v>>8);
+  return p+2;
+}
+
+static uint32_t get16(const uint8_t *p) {
+  return p[0] | (p[1]<<8);
+}
+
+static uint32_t clamp(uint32_t v, uint32_t max) {
+  return (v>max) ? max : v;
+}
+
+static uint32_t clampi(int v, uint32_t max) {
+  return (v<0) ? 0 : clamp((uint32_t)v,max);
+}
+
+int respack_encode(const struct sd_results *r, uint8_t *out) {
+  uint8_t *p = out;
+  int i;
+  *p++ = RESPACK_VERSION;
+  *p++ = r->haveAxes ? RESPACK_FLAG_AXES : 0;
+  *p++ = (uint8_t)clampi(r->alarmState,255);
+  *p++ = (uint8_t)clampi(r->alarmRoi,255);
+  *p++ = (uint8_t)clampi(r->sampleFreq,255);
+  *p++ = (uint8_t)clampi(r->maxFreq,255);
+  *p++ = (uint8_t)clampi(r->roiPeakRatio,255);
+  *p++ = (uint8_t)clampi(r->commsQueued,255);
+  p = put16(p,respack_ulog(r->specPower,11));
+  p = put16(p,respack_ulog(r->roiPower,11));
+  p = put16(p,respack_ulog(r->maxVal,11));
+  p = put16(p,clampi(r->peakFreq,0xffff));
+  p = put16(p,clampi(r->specCentroid,0xffff));
+  p = put16(p,r->numDropped);
+  p = put16(p,clamp(r->analysisLatency,0xffff));
+  p = put16(p,clamp(r->maxBlockTime,0xffff));
+  p = put16(p,r->numSkipped);
+  p = put16(p,r->commsDropped);
+  p = put16(p,r->commsRetries);
+  p = put16(p,r->commsCoalesced);
+  for (i=0;i<10;i++) *p++ = (uint8_t)respack_ulog(r->simpleSpec[i],3);
+  if (r->haveAxes) {
+    for (i=0;i<3;i++) p = put16(p,respack_ulog(r->axisRoiPowers[i],11));
+    for (i=0;i<3;i++) p = put16(p,respack_ulog(r->axisSpecPowers[i],11));
+  }
+  return p - out;
+}
+
+int respack_decode(const uint8_t *in, int n, struct sd_results *r) {
+  const uint8_t *p = in;
+  int i;
+  if (n<RESPACK_SIZE_MIN) return -1;
+  r->haveAxes = (p[1] & RESPACK_FLAG_AXES) && (n>=RESPACK_SIZE_MAX);
+  r->alarmState = p[2];
+  r->alarmRoi = p[3];
+  r->sampleFreq = p[4];
+  r->maxFreq = p[5];
+  r->roiPeakRatio = p[6];
+  r->commsQueued = p[7];
+  r->specPower = respack_unlog(get16(&p[8]),11);
+  r->roiPower = respack_unlog(get16(&p[10]),11);
+  r->maxVal = respack_unlog(get16(&p[12]),11);
+  r->peakFreq = get16(&p[14]);
+  r->specCentroid = get16(&p[16]);
+  r->numDropped = get16(&p[18]);
+  r->analysisLatency = get16(&p[20]);
+  r->maxBlockTime = get16(&p[22]);
+  r->numSkipped = get16(&p[24]);
+  r->commsDropped = get16(&p[26]);
+  r->commsRetries = get16(&p[28]);
+  r->commsCoalesced = get16(&p[30]);
+  for (i=0;i<10;i++) r->simpleSpec[i] = respack_unlog(p[32+i],3);
+  for (i=0;i<3;i++) {
+    r->axisRoiPowers[i] = r->haveAxes ? respack_unlog(get16(&p[42+2*i]),11) : 0;
+    r->axisSpecPowers[i] = r->haveAxes ? respack_unlog(get16(&p[48+2*i]),11) : 0;
+  }
+  return p[0];
+}
@@ -0,0 +1,101 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef __RESPACK_H__
+#define __RESPACK_H__
+
+#include <stdint.h>
+
+/*
+ * Packed binary encoding of the analysis results, sent to the phone as a
+ * single byte array (KEY_RESULTS_PACKED) instead of a dictionary entry
+ * with a 7 byte header for each value.
+ * Does not depend on the Pebble SDK so it can be tested on a PC.
+ *
+ * Powers are sent as 'ulog' values - a small floating point format with an
+ * exponent and bits mantissa bits, like a positive half precision float.
+ * Values below 2^bits are exact; above that the relative error is at most
+ * 2^-(bits+1).  16 bit values have 11 mantissa bits (0.05%) and the
+ * simplified spectrum 8 bit values with 3 (6%), which covers the full
+ * 32 bit range in both cases.
+ *
+ * Record (version 1, little endian):
+ *   0 version           1 flags (RESPACK_FLAG_*)  2 alarmState
+ *   3 alarmRoi          4 sampleFreq (Hz)         5 maxFreq (Hz)
+ *   6 roiPeakRatio (10x, max 255)                 7 commsQueued
+ *   8 specPower (ulog16)   10 roiPower (ulog16)   12 maxVal (ulog16)
+ *  14 peakFreq (mHz)       16 specCentroid (mHz)
+ *  18 numDropped           20 analysisLatency (ms)  22 maxBlockTime (ms)
+ *  24 numSkipped           26 commsDropped          28 commsRetries
+ *  30 commsCoalesced       (counters are sent modulo 2^16)
+ *  32 simpleSpec[10] (ulog8)
+ *  42 axisRoiPowers[3], axisSpecPowers[3] (ulog16) - only if
+ *     RESPACK_FLAG_AXES is set.
+ * Fields are only ever added to the end, so a phone can read the start
+ * of a record with a later version.
+ */
+#define RESPACK_VERSION 1
+#define RESPACK_FLAG_AXES 0x01   // record includes the per axis powers.
+#define RESPACK_SIZE_MIN 42      // size of a record without the axes.
+#define RESPACK_SIZE_MAX 54      // size of a record with the axes.
+
+struct sd_results {
+  int alarmState;
+  int alarmRoi;
+  int sampleFreq;
+  int maxFreq;
+  int roiPeakRatio;
+  int commsQueued;
+  uint32_t specPower;
+  uint32_t roiPower;
+  uint32_t maxVal;
+  int peakFreq;
+  int specCentroid;
+  uint32_t numDropped;
+  uint32_t analysisLatency;
+  uint32_t maxBlockTime;
+  uint32_t numSkipped;
+  uint32_t commsDropped;
+  uint32_t commsRetries;
+  uint32_t commsCoalesced;
+  uint32_t simpleSpec[10];
+  int haveAxes;              // the axis powers are valid.
+  uint32_t axisRoiPowers[3];
+  uint32_t axisSpecPowers[3];
+};
+
+// Encode v as a ulog value with bits mantissa bits (rounded to nearest).
+uint32_t respack_ulog(uint32_t v, int bits);
+
+// Decode a ulog value with bits mantissa bits.
+uint32_t respack_unlog(uint32_t code, int bits);
+
+// Write the record for r to out (RESPACK_SIZE_MAX bytes) - returns its size.
+int respack_encode(const struct sd_results *r, uint8_t *out);
+
+// Read a record of n bytes from in into r - returns the version, or -1 if
+// the record is too short.
+int respack_decode(const uint8_t *in, int n, struct sd_results *r);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "spectrum.h"
+
+/**
+ * bin_power():  Returns the power (re^2 + im^2) * 2^(2*exp), rounded and
+ * limited to SPEC_POWER_MAX.
+ */
+static inline uint64_t bin_power(int32_t re, int32_t im, int exp) {
+  uint64_t p = (uint64_t)((int64_t)re*re) + (uint64_t)((int64_t)im*im);
+  if (exp<0) {
+    p = (p + ((uint64_t)1<<(-2*exp-1))) >> (-2*exp);
+  } else if (exp>0) {
+    if (p>=(SPEC_POWER_MAX>>(2*exp))) return SPEC_POWER_MAX;
+    p = p << (2*exp);
+  }
+  return (p>SPEC_POWER_MAX) ? SPEC_POWER_MAX : p;
+}
+
+/**
+ * spec_features():  see spectrum.h.   All of the features are collected in
+ * the same loop that calculates the bin powers, so the spectrum is only
+ * read once; only the interpolation and ratios need divisions, and they are
+ * done once per spectrum.
+ */
+void spec_features(const int32_t *data, int exp, int nBins, int nCut,
+		   int roiMin, int roiMax,
+		   spec_cum_t *cum, short *mags, struct spec_features *f) {
+  int i;
+  uint64_t sum = 0;
+  uint64_t peak = 0, roiPeak = 0;
+  int peakBin = 0;
+  uint64_t moment = 0;   // sum of bin number x power.
+
+  if (nCut>nBins-1) nCut = nBins-1;
+  if (roiMin<1) roiMin = 1;
+  if (roiMax>nBins) roiMax = nBins;
+
+  cum[0] = 0;
+  cum[1] = 0;
+  if (mags) mags[0] = 0;
+  for (i=1;i<=nCut;i++) {
+    uint64_t p = bin_power(data[2*i],data[2*i+1],exp);
+    sum += p;
+    cum[i+1] = (sum>SPEC_CUM_MAX) ? (spec_cum_t)SPEC_CUM_MAX : (spec_cum_t)sum;
+    if (mags) mags[i] = (p>32767) ? 32767 : (short)p;
+    moment += i*p;
+    if (p>peak) {
+      peak = p;
+      peakBin = i;
+    }
+    if ((i>=roiMin) && (i<roiMax) && (p>roiPeak)) roiPeak = p;
+  }
+  for (;i<nBins;i++) {
+    cum[i+1] = cum[i];
+    if (mags) mags[i] = 0;
+  }
+
+  f->power = sum;
+  f->peakPower = peak;
+  f->peakBin = peakBin;
+  f->peakPos = peakBin << SPEC_FRAC_BITS;
+  // Parabola through the peak and its neighbours - the vertex is
+  // (c-a)/(2(2b-a-c)) bins from the peak, which is within +/-0.5 bins.
+  if ((peakBin>1) && (peakBin<nCut)) {
+    int64_t a = cum[peakBin] - cum[peakBin-1];
+    int64_t b = peak;
+    int64_t c = cum[peakBin+2] - cum[peakBin+1];
+    int64_t den = 2*b - a - c;
+    if (den>0)
+      f->peakPos += (int)((c-a)*(1<<(SPEC_FRAC_BITS-1))/den);
+  }
+  f->centroid = 0;
+  if (sum>0)
+    f->centroid = (int)((moment << SPEC_FRAC_BITS)/sum);
+  f->roiPeakRatio = 0;
+  if (roiMax>roiMin) {
+    uint64_t roiSum = cum[roiMax] - cum[roiMin];
+    if (roiSum>0)
+      f->roiPeakRatio = (int)(10*roiPeak*(roiMax-roiMin)/roiSum);
+  }
+}
+
+
+/**
+ * spec_recip_init():  see spectrum.h.
+ */
+void spec_recip_init(struct spec_recip *r, uint32_t divisor) {
+  int l = 0;
+  if (divisor<1) divisor = 1;
+  r->d = divisor;
+  while (((uint64_t)1<<l)<divisor) l++;
+  r->m = (uint32_t)(((((uint64_t)1<<l) - divisor) << 32)/divisor + 1);
+  r->sh1 = (l<1) ? l : 1;
+  r->sh2 = (l>1) ? l-1 : 0;
+}
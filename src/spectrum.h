@@ -0,0 +1,117 @@
+/*
+  Pebble_sd - a simple accelerometer based seizure detector that runs on a
+  Pebble smart watch (http://getpebble.com).
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef __SPECTRUM_H__
+#define __SPECTRUM_H__
+
+#include <stdint.h>
+
+/*
+ * Spectrum reduction - calculates the power in each bin of a spectrum and
+ * the features of the spectrum that are sent to the phone in a single pass.
+ * Does not depend on the Pebble SDK so it can be tested on a PC.
+ *
+ * The spectrum is nBins complex values stored as (real, imaginary) pairs
+ * of int32_t (the layout of fft_complex_t), with a block exponent exp - the
+ * values are data * 2^exp (as returned by fft_fftr_bfp()).   The power in
+ * a bin is (re^2 + im^2) * 2^(2*exp), calculated with 64 bit arithmetic
+ * and limited to SPEC_POWER_MAX so that the sums can not overflow.
+ */
+#define SPEC_FRAC_BITS 8   // fractional bits of peakPos and centroid.
+#define SPEC_POWER_MAX ((uint64_t)1<<39)  // largest power in one bin.
+
+/*
+ * The cumulative powers are 64 bit, unless SPEC_CUM_BITS is 32 (set by
+ * wscript on aplite to halve their memory), when they stop at
+ * SPEC_CUM_MAX.   The total power of a window is 8 x its variance, so
+ * it only reaches 2^32 for swings of more than +/-23 g - far outside the
+ * range of the accelerometer.
+ */
+#ifndef SPEC_CUM_BITS
+#define SPEC_CUM_BITS 64
+#endif
+#if SPEC_CUM_BITS == 32
+typedef uint32_t spec_cum_t;
+#define SPEC_CUM_MAX ((uint64_t)UINT32_MAX)
+#else
+typedef uint64_t spec_cum_t;
+#define SPEC_CUM_MAX UINT64_MAX
+#endif
+
+struct spec_features {
+  uint64_t power;      // total power in bins 1 to nCut.
+  uint64_t peakPower;  // power in the highest bin.
+  int peakBin;         // bin number of the highest bin (0 if no power).
+  int peakPos;         // peak position (bins << SPEC_FRAC_BITS), refined by
+                       // fitting a parabola to the highest bin and its
+                       // neighbours.
+  int centroid;        // power weighted mean bin number
+                       // (bins << SPEC_FRAC_BITS).
+  int roiPeakRatio;    // 10 x highest bin power / mean bin power within the
+                       // region of interest.
+};
+
+// Calculates the power in bins 1 to nCut of the spectrum (bins above nCut
+// and bin 0 count as zero) into mags (limited to SHRT_MAX, for display -
+// or NULL to leave the magnitudes as they are)
+// and the cumulative power into cum (cum[i] = power in bins 1 to i-1, so
+// cum needs nBins+1 entries), and the features of the spectrum into *f.
+// The region of interest is bins roiMin to roiMax-1.
+void spec_features(const int32_t *data, int exp, int nBins, int nCut,
+		   int roiMin, int roiMax,
+		   spec_cum_t *cum, short *mags, struct spec_features *f);
+
+/*
+ * The mean power per bin in bins binMin to binMax-1 is
+ * (cum[binMax]-cum[binMin])/(binMax-binMin).
+ *
+ * Division by a number that is known in advance (such as the number of bins
+ * in a band), done as a multiply by its reciprocal and two shifts, which
+ * is much quicker than a division on the watch.   The result is exactly
+ * n / divisor (rounded down) for every uint32_t n.
+ */
+struct spec_recip {
+  uint32_t d;           // divisor.
+  uint32_t m;           // 2^32 x (2^l - divisor)/divisor + 1, where
+                        // 2^l is the smallest power of 2 >= divisor.
+  uint8_t sh1, sh2;     // min(l,1) and max(l-1,0).
+};
+
+// Set up *r to divide by divisor (divisor 0 is treated as 1).
+void spec_recip_init(struct spec_recip *r, uint32_t divisor);
+
+// Returns n / divisor.
+static inline uint32_t spec_recip_div(uint32_t n, const struct spec_recip *r) {
+  uint32_t t = (uint32_t)(((uint64_t)n*r->m) >> 32);
+  return (t + ((n - t) >> r->sh1)) >> r->sh2;
+}
+
+// Returns n / divisor for a 64 bit n - only numerators of 2^32 or more
+// need a (slow) 64 bit division.
+static inline uint64_t spec_recip_div64(uint64_t n, const struct spec_recip *r) {
+  if (n>>32) return n/r->d;
+  return spec_recip_div((uint32_t)n,r);
+}
+
+#endif
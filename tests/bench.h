@@ -0,0 +1,76 @@
+/*
+  bench.h - timing and test data shared by the benchmarks in this directory.
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017.
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * Returns a time stamp - CPU cycles where available, otherwise nanoseconds.
+ */
+static inline uint64_t bench_time() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+  // DWT cycle counter - enabled by the first call.
+  volatile uint32_t *demcr = (uint32_t*)0xE000EDFC;
+  volatile uint32_t *dwtCtrl = (uint32_t*)0xE0001000;
+  volatile uint32_t *dwtCyccnt = (uint32_t*)0xE0001004;
+  if (!(*dwtCtrl & 1)) {
+    *demcr |= 0x01000000;
+    *dwtCyccnt = 0;
+    *dwtCtrl |= 1;
+  }
+  return *dwtCyccnt;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Fill data with nSamp samples, taken at sampFreq Hz, of an offset (1g)
+ * plus a freq Hz wave of amplitude ampl and random noise of up to +/-noise.
+ * The noise is the same on every call.
+ */
+static inline void populate_data(int32_t *data, int nSamp, int sampFreq,
+				 double freq, int ampl, int noise) {
+  int i;
+  srand(1);
+  for (i=0;i<nSamp;i++) {
+    double t = (double)i/sampFreq;
+    data[i] = 1000 + (int)(ampl*sin(2*M_PI*freq*t))
+      + rand()%(2*noise+1) - noise;
+  }
+}
+
+#endif
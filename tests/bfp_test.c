@@ -0,0 +1,154 @@
+/*
+  bfp_test.c - compare the accuracy and speed of the block floating point
+  FFT (fft_fftr_bfp()) and the plain fixed point FFT (fft_fftr()) against a
+  double precision DFT, for quiet and loud signals.
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017.
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* These undefines prevent SYLT-FFT using assembler code */
+#undef __ARMCC_VERSION
+#undef __arm__
+#include "../src/SYLT-FFT/fft.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* CONFIGURATION */
+#define SAMP_FREQ 25      // Sample Frequency in Hz
+#define ROI_MIN 3         // Hz - region of interest
+#define ROI_MAX 8         // Hz
+#define TONE_FREQ 5.3     // Hz - frequency of the test signal.
+#define TOLERANCE 0.01    // allowed relative error in BFP ROI power.
+#define NREPEAT 2000      // Number of times to repeat each FFT for timing.
+#define NSAMP_MAX 512
+
+int32_t accData[NSAMP_MAX];
+fft_complex_t fftData[NSAMP_MAX/2];
+double refPower[NSAMP_MAX/2];
+
+/**
+ * Power in bins 1 to nSamp/2-1 by a double precision DFT, with the same
+ * scaling as fft_fftr() (4/nSamp x the DFT).
+ */
+static void dft_power(int nSamp) {
+  int i,k;
+  for (k=1;k<nSamp/2;k++) {
+    double re = 0, im = 0;
+    for (i=0;i<nSamp;i++) {
+      re += accData[i]*cos(2*M_PI*k*i/nSamp);
+      im -= accData[i]*sin(2*M_PI*k*i/nSamp);
+    }
+    re = 4*re/nSamp;
+    im = 4*im/nSamp;
+    refPower[k] = re*re + im*im;
+  }
+}
+
+/**
+ * Compare the power in fftData (scaled by 2^(2*exp)) with refPower.
+ * Returns the relative error in the ROI power, and sets *specErr to the
+ * largest error in any bin relative to the largest bin.
+ */
+static double compare(int nSamp, int exp, double *specErr) {
+  int k;
+  int freqRes = 1000*SAMP_FREQ/nSamp;
+  int nMin = 1000*ROI_MIN/freqRes;
+  int nMax = 1000*ROI_MAX/freqRes;
+  double roi = 0, roiRef = 0, maxErr = 0, pMax = 0;
+  for (k=1;k<nSamp/2;k++) {
+    double p = ((double)fftData[k].r*fftData[k].r
+		+ (double)fftData[k].i*fftData[k].i) * pow(2,2*exp);
+    if (refPower[k]>pMax) pMax = refPower[k];
+    if (fabs(p-refPower[k])>maxErr) maxErr = fabs(p-refPower[k]);
+    if ((k>=nMin) && (k<nMax)) {
+      roi += p;
+      roiRef += refPower[k];
+    }
+  }
+  *specErr = maxErr/pMax;
+  return fabs(roi-roiRef)/roiRef;
+}
+
+/**
+ * Compare both FFTs for one window length and signal amplitude - returns 1
+ * if the BFP FFT is within TOLERANCE.
+ */
+static int check(int nSamp, int fftBits, int ampl) {
+  int i,exp = 0;
+  double roiErr, roiErrBfp, specErr, specErrBfp;
+
+  populate_data(accData,nSamp,SAMP_FREQ,TONE_FREQ,ampl,2);
+  dft_power(nSamp);
+
+  for (i=0;i<nSamp;i++) ((int32_t*)fftData)[i] = accData[i];
+  fft_fftr(fftData,fftBits);
+  roiErr = compare(nSamp,0,&specErr);
+
+  for (i=0;i<nSamp;i++) ((int32_t*)fftData)[i] = accData[i];
+  exp = fft_fftr_bfp(fftData,fftBits);
+  roiErrBfp = compare(nSamp,exp,&specErrBfp);
+
+  printf("nSamp=%4d ampl=%5d  ROI power error: fixed=%7.3f%% bfp=%7.3f%% (exp %3d)  worst bin: fixed=%7.3f%% bfp=%7.3f%% of peak\n",
+	 nSamp,ampl,100*roiErr,100*roiErrBfp,exp,100*specErr,100*specErrBfp);
+  return roiErrBfp<=TOLERANCE;
+}
+
+/**
+ * Time both FFTs for one window length.
+ */
+static void bench(int nSamp, int fftBits) {
+  int i,rep;
+  uint64_t t0, tFixed, tBfp;
+  populate_data(accData,nSamp,SAMP_FREQ,TONE_FREQ,100,2);
+  t0 = bench_time();
+  for (rep=0;rep<NREPEAT;rep++) {
+    for (i=0;i<nSamp;i++) ((int32_t*)fftData)[i] = accData[i];
+    fft_fftr(fftData,fftBits);
+  }
+  tFixed = (bench_time()-t0)/NREPEAT;
+  t0 = bench_time();
+  for (rep=0;rep<NREPEAT;rep++) {
+    for (i=0;i<nSamp;i++) ((int32_t*)fftData)[i] = accData[i];
+    fft_fftr_bfp(fftData,fftBits);
+  }
+  tBfp = (bench_time()-t0)/NREPEAT;
+  printf("nSamp=%4d  fixed=%7lu  bfp=%7lu (x%4.2f) CPU cycles\n",
+	 nSamp,(unsigned long)tFixed,(unsigned long)tBfp,
+	 (double)tBfp/tFixed);
+}
+
+int main(void) {
+  int ok = 1;
+  int ampl;
+  sine_init();   // the sine table is generated at run time on the host.
+  for (ampl=2;ampl<=2000;ampl*=10) {
+    ok &= check(128,6,ampl);
+    ok &= check(512,8,ampl);
+  }
+  bench(128,6);
+  bench(256,7);
+  bench(512,8);
+  printf("%s\n",ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
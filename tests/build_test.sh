@@ -1,3 +1,14 @@
 #!/bin/sh
 cc -std=c99 fft_test.c -lm -o fft_test
 
+cc -std=c99 -O2 goertzel_bench.c ../src/goertzel.c -lm -o goertzel_bench
+cc -std=c99 -O2 fall_bench.c ../src/fall_detect.c -o fall_bench
+cc -std=c99 -O2 decimate_test.c ../src/decimate.c -lm -o decimate_test
+cc -std=c99 -O2 rawpack_bench.c ../src/rawpack.c -lm -o rawpack_bench
+cc -std=c99 -O2 respack_bench.c ../src/respack.c -o respack_bench
+cc -std=c99 -O2 spectrum_bench.c ../src/spectrum.c -lm -o spectrum_bench
+cc -std=c99 -O2 bfp_test.c -lm -o bfp_test
+cc -std=c99 -O2 fft_r4_bench.c -lm -o fft_r4_bench
+# Cortex-M3 build of the FFT benchmark (times from the DWT cycle counter),
+# to run on a simulator with semihosting that models the cycle counter:
+#   arm-none-eabi-gcc -std=c99 -O2 -mcpu=cortex-m3 -mthumb --specs=rdimon.specs fft_r4_bench.c -lm -o fft_r4_bench.elf
@@ -0,0 +1,175 @@
+/*
+  decimate_test.c - check that decimating the accelerometer data to 25 Hz
+  before the FFT gives the same ROI power as analysing it at the full rate.
+  The reference is the ROI power of the full rate data calculated in double
+  precision - the fixed point FFT of the full rate data is shown too.
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017.
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* These undefines prevent SYLT-FFT using assembler code */
+#undef __ARMCC_VERSION
+#undef __arm__
+#include "../src/SYLT-FFT/fft.h"
+#include "../src/decimate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* CONFIGURATION */
+#define DECIM_FREQ 25     // Hz - sampling frequency after decimation.
+#define PERIOD_BITS 7     // window is 2^PERIOD_BITS samples at DECIM_FREQ
+#define ROI_MIN 3         // Hz - region of interest
+#define ROI_MAX 10        // Hz
+#define TOLERANCE 0.05    // allowed relative difference in ROI power.
+#define NSAMP_MAX 512
+
+int32_t accData[2*NSAMP_MAX];
+fft_complex_t fftData[NSAMP_MAX/2];
+struct decimator decim;
+
+/**
+ * Fill accData with n samples at sampFreq Hz - an offset (1g), three tones
+ * in the region of interest, a large tone at aliasFreq that would alias
+ * into the region of interest if it was not filtered out, and some noise.
+ */
+static void populate_data(int n, int sampFreq, double aliasFreq) {
+  int i;
+  unsigned seed = 12345;
+  for (i=0;i<n;i++) {
+    double t = (double)i/sampFreq;
+    double x = 1000
+      + 150*sin(2*M_PI*3.7*t)
+      + 300*sin(2*M_PI*5.0*t+0.3)
+      + 100*sin(2*M_PI*8.6*t+1.1)
+      + 400*sin(2*M_PI*aliasFreq*t);
+    seed = seed*1103515245 + 12345;
+    x += (int)((seed>>16)&0x3f) - 32;
+    accData[i] = (int32_t)x;
+  }
+}
+
+/**
+ * Average power per bin between ROI_MIN and ROI_MAX of the nSamp samples
+ * in buf, calculated the same way as analysis.c.
+ */
+static long roi_power(int32_t *buf, int nSamp, int sampFreq) {
+  int i;
+  int fftBits = 0;
+  int freqRes = 1000*sampFreq/nSamp;
+  int nMin = 1000*ROI_MIN/freqRes;
+  int nMax = 1000*ROI_MAX/freqRes;
+  long power = 0;
+  // nSamp real samples use an FFT of nSamp/2 = 2^fftBits complex points.
+  while ((2<<fftBits)<nSamp) fftBits++;
+  for (i=0;i<nSamp;i++) ((int32_t*)fftData)[i] = buf[i];
+  fft_fftr(fftData,fftBits);
+  for (i=nMin;i<nMax;i++)
+    power += fftData[i].r*fftData[i].r + fftData[i].i*fftData[i].i;
+  return power/(nMax-nMin);
+}
+
+/**
+ * Average power per bin between ROI_MIN and ROI_MAX of the nSamp samples
+ * in buf, calculated by a double precision DFT with the same scaling as
+ * fft_fftr().
+ */
+static double roi_power_ref(int32_t *buf, int nSamp, int sampFreq) {
+  int i,k;
+  int freqRes = 1000*sampFreq/nSamp;
+  int nMin = 1000*ROI_MIN/freqRes;
+  int nMax = 1000*ROI_MAX/freqRes;
+  double power = 0;
+  for (k=nMin;k<nMax;k++) {
+    double re = 0, im = 0;
+    for (i=0;i<nSamp;i++) {
+      re += buf[i]*cos(2*M_PI*k*i/nSamp);
+      im -= buf[i]*sin(2*M_PI*k*i/nSamp);
+    }
+    re = 4*re/nSamp;
+    im = 4*im/nSamp;
+    power += re*re + im*im;
+  }
+  return power/(nMax-nMin);
+}
+
+/**
+ * Compare the ROI power of the last window of data at sampFreq with that
+ * of the same data decimated to DECIM_FREQ.  Returns 1 if they agree.
+ */
+static int check_factor(int factor, double aliasFreq) {
+  int sampFreq = factor*DECIM_FREQ;
+  int nSampDec = 1<<PERIOD_BITS;
+  int nSamp = factor*nSampDec;
+  int n = 2*nSamp;
+  int nDec = 0;
+  int delay, i;
+  long fullPower, decPower, undecPower;
+  double refPower, err;
+  static int32_t decData[NSAMP_MAX];
+  static int32_t undecData[NSAMP_MAX];
+
+  populate_data(n,sampFreq,aliasFreq);
+  decim_init(&decim,factor);
+  for (i=0;i<n;i++) {
+    int32_t y;
+    if (decim_push(&decim,accData[i],&y)) {
+      // keep the latest window of decimated data.
+      if (nDec>=nSampDec) {
+	for (int j=1;j<nSampDec;j++) decData[j-1] = decData[j];
+	nDec = nSampDec-1;
+      }
+      decData[nDec++] = y;
+    }
+    // every factor'th sample without filtering, to show the aliasing (the
+    // window is stored circularly, which does not change the power spectrum).
+    if (i%factor==factor-1) undecData[(i/factor)%nSampDec] = accData[i];
+  }
+
+  // The decimated data is delayed by the filter, so compare it with the
+  // full rate window that ends (nTaps-1)/2 samples earlier.
+  delay = (decim.nTaps-1)/2;
+  refPower = roi_power_ref(&accData[n-nSamp-delay],nSamp,sampFreq);
+  fullPower = roi_power(&accData[n-nSamp-delay],nSamp,sampFreq);
+  decPower = roi_power(decData,nSampDec,DECIM_FREQ);
+  undecPower = roi_power(undecData,nSampDec,DECIM_FREQ);
+
+  err = fabs(decPower-refPower)/refPower;
+  printf("factor %d (%3d Hz -> %d Hz), %4.1f Hz tone: ROI power full rate=%.0f (fixed point %ld), decimated=%ld (%.1f%%), unfiltered=%ld\n",
+	 factor,sampFreq,DECIM_FREQ,aliasFreq,refPower,fullPower,decPower,
+	 100*err,undecPower);
+  return err<=TOLERANCE;
+}
+
+int main(void) {
+  int ok = 1;
+  sine_init();   // the sine table is generated at run time on the host.
+  // Tones that alias to 5 Hz or 8 Hz (in the ROI) at 25 Hz.
+  ok &= check_factor(4,20.0);
+  ok &= check_factor(4,33.0);
+  ok &= check_factor(2,17.0);
+  ok &= check_factor(2,20.0);
+  // Tones that alias to the top edge of the ROI or below it.
+  ok &= check_factor(4,40.0);
+  ok &= check_factor(2,24.0);
+  printf("%s\n",ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+/*
+  fall_bench.c - compare the streaming fall detector with the original
+  check_fall() method of re-scanning every window, and check that it finds
+  the same falls as a search back from every impact.
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017.
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "../src/fall_detect.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* CONFIGURATION */
+#define SAMP_FREQ 100    // Sample Frequency in Hz
+#define NSAMP 512        // number of samples in the buffer
+#define THRESH_MIN 200   // milli-g
+#define THRESH_MAX 2000  // milli-g (above the walking data so only the
+                         // impact counts).
+#define NREPEAT 2000     // Number of times to repeat each check.
+
+int16_t accData[NSAMP];
+struct fall_detector fd;
+volatile int sink;  // stops the timed loops being optimised away.
+
+/**
+ * Original check_fall() - find the min and max of every window.
+ * Returns the number of windows that contain both a free fall and an impact.
+ */
+static int fall_window(int win) {
+  int i,j,n = 0;
+  for (i=0;i<=NSAMP-win;i++) {
+    int minAcc = accData[i], maxAcc = accData[i];
+    for (j=0;j<win;j++) {
+      if (accData[i+j]<minAcc) minAcc = accData[i+j];
+      if (accData[i+j]>maxAcc) maxAcc = accData[i+j];
+    }
+    if ((minAcc<THRESH_MIN) && (maxAcc>THRESH_MAX)) n++;
+  }
+  return n;
+}
+
+/**
+ * Reference check - for every impact sample search back through the
+ * window for a free fall sample after the previous fall.
+ * Returns the number of falls.
+ */
+static int fall_naive(int win) {
+  int i,j,n = 0, lastFall = -1;
+  for (i=0;i<NSAMP;i++) {
+    if (accData[i]<=THRESH_MAX) continue;
+    for (j=i-1;(j>i-win) && (j>lastFall);j--) {
+      if (accData[j]<THRESH_MIN) {
+	n++;
+	lastFall = i;
+	break;
+      }
+    }
+  }
+  return n;
+}
+
+/**
+ * Streaming detector - one fall_update() per sample.
+ */
+static int fall_stream(int win) {
+  int i,n = 0;
+  fall_init(&fd,THRESH_MIN,THRESH_MAX,win,0,0,0);
+  for (i=0;i<NSAMP;i++) n += fall_update(&fd,accData[i]);
+  return n;
+}
+
+/**
+ * main():  Main programme entry point.
+ */
+int main(void) {
+  int fallWindow, i, rep, nNaive, nStream = 0;
+  int failed = 0;
+  uint64_t t0, tWindow, tStream;
+
+  // Walking around (1000 +/- 400 milli-g) with a single fall in the
+  // middle of the buffer - the impact is 31 samples after the free fall.
+  srand(1);
+  for (i=0;i<NSAMP;i++) accData[i] = 1000 + rand()%800 - 400;
+  for (i=250;i<270;i++) accData[i] = 100;   // free fall
+  accData[300] = 2500;                      // impact
+
+  printf("fall_bench - time per check of %d samples (CPU cycles)\n",
+	 NSAMP);
+  for (fallWindow=250;fallWindow<=5000;fallWindow+=250) {
+    int win = fallWindow*SAMP_FREQ/1000;
+    if (win>NSAMP) break;
+    t0 = bench_time();
+    for (rep=0;rep<NREPEAT;rep++) sink = fall_window(win);
+    tWindow = (bench_time()-t0)/NREPEAT;
+    t0 = bench_time();
+    for (rep=0;rep<NREPEAT;rep++) nStream = fall_stream(win);
+    tStream = (bench_time()-t0)/NREPEAT;
+    nNaive = fall_naive(win);
+    printf("fallWindow=%4d ms  window=%8lu  stream=%6lu  speedup=%5.1f  falls=%d/%d\n",
+	   fallWindow,(unsigned long)tWindow,(unsigned long)tStream,
+	   (double)tWindow/tStream,nNaive,nStream);
+    if (nNaive!=nStream) failed = 1;
+    if (nStream!=((win>31) ? 1 : 0)) failed = 1;
+  }
+  if (failed) printf("**** FAILED - results differ ****\n");
+  return failed;
+}
@@ -0,0 +1,165 @@
+/*
+  fft_r4_bench.c - compare the size specialised radix-4 FFT (fft_r4_fftr_bfp())
+  with the radix-2 FFT (fft_fftr_bfp()) for the 128, 256 and 512 sample
+  windows - accuracy against a double precision DFT, and speed.
+
+  Build for the host with build_test.sh.   On a Cortex-M3/M4 build (see the
+  comment in build_test.sh) the times are read from the DWT cycle counter.
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017.
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* These undefines prevent SYLT-FFT using assembler code */
+#undef __ARMCC_VERSION
+#undef __arm__
+#include "../src/SYLT-FFT/fft.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* CONFIGURATION */
+#define SAMP_FREQ 25      // Sample Frequency in Hz
+#define TOLERANCE 0.0001  // allowed error in any bin, relative to the peak.
+#define NREPEAT 2000      // Number of times to repeat each FFT for timing.
+#define NSAMP_MAX 512
+
+int32_t accData[NSAMP_MAX];
+fft_complex_t fftData[NSAMP_MAX/2];
+double refPower[NSAMP_MAX/2];
+fft_r4_t r4;
+
+/**
+ * Populate accData with nSamp samples of an offset (1g) plus three tones of
+ * amplitude ampl and a little noise.
+ */
+static void populate_tones(int nSamp, int ampl) {
+  int i;
+  populate_data(accData,nSamp,SAMP_FREQ,5.3,ampl,2);
+  for (i=0;i<nSamp;i++) {
+    double t = (double)i/SAMP_FREQ;
+    accData[i] += (int)(ampl*0.5*sin(2*M_PI*2.1*t+0.4))
+      + (int)(ampl*0.2*sin(2*M_PI*9.7*t+1.3));
+  }
+}
+/**
+ * Power in bins 1 to nSamp/2-1 by a double precision DFT, with the same
+ * scaling as fft_fftr() (4/nSamp x the DFT).
+ */
+static void dft_power(int nSamp) {
+  int i,k;
+  for (k=1;k<nSamp/2;k++) {
+    double re = 0, im = 0;
+    for (i=0;i<nSamp;i++) {
+      re += accData[i]*cos(2*M_PI*k*i/nSamp);
+      im -= accData[i]*sin(2*M_PI*k*i/nSamp);
+    }
+    re = 4*re/nSamp;
+    im = 4*im/nSamp;
+    refPower[k] = re*re + im*im;
+  }
+}
+
+/**
+ * Largest difference between the power in fftData (scaled by 2^(2*exp))
+ * and refPower in any bin, relative to the largest bin.
+ */
+static double compare(int nSamp, int exp) {
+  int k;
+  double maxErr = 0, pMax = 0;
+  for (k=1;k<nSamp/2;k++) {
+    double p = ((double)fftData[k].r*fftData[k].r
+		+ (double)fftData[k].i*fftData[k].i) * pow(2,2*exp);
+    if (refPower[k]>pMax) pMax = refPower[k];
+    if (fabs(p-refPower[k])>maxErr) maxErr = fabs(p-refPower[k]);
+  }
+  return maxErr/pMax;
+}
+
+/**
+ * Compare both FFTs for one window length and signal amplitude - returns 1
+ * if the radix-4 FFT is within TOLERANCE.
+ */
+static int check(int nSamp, int fftBits, int ampl) {
+  int i,exp;
+  double err2, err4;
+
+  populate_tones(nSamp,ampl);
+  dft_power(nSamp);
+
+  for (i=0;i<nSamp;i++) ((int32_t*)fftData)[i] = accData[i];
+  exp = fft_fftr_bfp(fftData,fftBits);
+  err2 = compare(nSamp,exp);
+
+  if (!fft_r4_init(&r4,fftBits)) {
+    printf("nSamp=%4d - no radix-4 kernel\n",nSamp);
+    return 0;
+  }
+  for (i=0;i<nSamp;i++) ((int32_t*)fftData)[i] = accData[i];
+  exp = fft_r4_fftr_bfp(&r4,fftData);
+  err4 = compare(nSamp,exp);
+
+  printf("nSamp=%4d ampl=%5d  worst bin error: radix-2=%8.5f%% radix-4=%8.5f%% of peak\n",
+	 nSamp,ampl,100*err2,100*err4);
+  return err4<=TOLERANCE;
+}
+
+/**
+ * Time both FFTs for one window length.
+ */
+static void bench(int nSamp, int fftBits) {
+  int i,rep;
+  uint64_t t0, t2, t4;
+  populate_tones(nSamp,100);
+  fft_r4_init(&r4,fftBits);
+  t0 = bench_time();
+  for (rep=0;rep<NREPEAT;rep++) {
+    for (i=0;i<nSamp;i++) ((int32_t*)fftData)[i] = accData[i];
+    fft_fftr_bfp(fftData,fftBits);
+  }
+  t2 = (bench_time()-t0)/NREPEAT;
+  t0 = bench_time();
+  for (rep=0;rep<NREPEAT;rep++) {
+    for (i=0;i<nSamp;i++) ((int32_t*)fftData)[i] = accData[i];
+    fft_r4_fftr_bfp(&r4,fftData);
+  }
+  t4 = (bench_time()-t0)/NREPEAT;
+  printf("nSamp=%4d  radix-2=%7lu  radix-4=%7lu (x%4.2f) CPU cycles\n",
+	 nSamp,(unsigned long)t2,(unsigned long)t4,(double)t4/t2);
+}
+
+int main(void) {
+  int ok = 1;
+  int ampl;
+  sine_init();   // the sine table is generated at run time on the host.
+  for (ampl=2;ampl<=2000;ampl*=10) {
+    ok &= check(128,6,ampl);
+    ok &= check(256,7,ampl);
+    ok &= check(512,8,ampl);
+  }
+  // Sizes without a kernel are refused.
+  ok &= !fft_r4_init(&r4,5) && !fft_r4_init(&r4,9) && (r4.bits==0);
+  bench(128,6);
+  bench(256,7);
+  bench(512,8);
+  printf("%s\n",ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -117,10 +117,43 @@ static void do_analysis() {
 }
 
 
+/**
+ * check_tone():  Regression test for the radix-2 butterfly with a -i twiddle
+ * factor - a cosine at an exact bin frequency must give a single peak (and
+ * its mirror image) with no more than 0.1% of its power in any other bin.
+ * Returns 0 if the test passes, otherwise 1.
+ */
+static int check_tone() {
+  int i, bin = 10;
+  int64_t p, peak, worst = 0;
+
+  for (i=0;i<NSAMP;i++) {
+    fftdata[i].r = (int)(10000*cos(2*M_PI*bin*i/NSAMP));
+    fftdata[i].i = 0;
+  }
+  fft_fft(fftdata,FFT_BITS);
+  peak = (int64_t)fftdata[bin].r*fftdata[bin].r
+    + (int64_t)fftdata[bin].i*fftdata[bin].i;
+  for (i=0;i<NSAMP;i++) {
+    if ((i==bin) || (i==NSAMP-bin)) continue;
+    p = (int64_t)fftdata[i].r*fftdata[i].r + (int64_t)fftdata[i].i*fftdata[i].i;
+    if (p>worst) worst = p;
+  }
+  printf("check_tone: bin %d power=%lld, worst other bin=%lld (%.4f%%)\n",
+	 bin,(long long)peak,(long long)worst,100.*worst/peak);
+  if ((peak==0) || (worst*1000>peak)) {
+    printf("check_tone: FAILED\n");
+    return 1;
+  }
+  printf("check_tone: PASS\n");
+  return 0;
+}
+
 /**
  * main():  Main programme entry point.
  */
 int main(void) {
+  sine_init();   // the sine table is generated at run time on the host.
   printf("fft_test\n");
   printf("SAMP_FREQ=%d Hz - fMax = %d\n ",SAMP_FREQ,SAMP_FREQ/2);
   printf("NSAMP = %d\n",NSAMP);
@@ -130,4 +163,5 @@ int main(void) {
 
   populate_data();
   do_analysis();
+  return check_tone();
 }
@@ -0,0 +1,158 @@
+/*
+  goertzel_bench.c - compare the cost of the Goertzel filter bank used by
+  SD_MODE_GOERTZEL with the fft_fftr() analysis used by SD_MODE_FFT.
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017.
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* These undefines prevent SYLT-FFT using assembler code */
+#undef __ARMCC_VERSION
+#undef __arm__
+#include "../src/SYLT-FFT/fft.h"
+#include "../src/goertzel.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* CONFIGURATION */
+#define SAMP_FREQ 100    // Sample Frequency in Hz
+#define FREQ_MIN 3       // Region of interest (Hz)
+#define FREQ_MAX 8
+#define NREPEAT 2000     // Number of times to repeat each calculation.
+#define GOERTZEL_STEP_SAMPLES 32 // as pebble_sd.h
+
+int16_t accData[512];
+int32_t fftBuf[512];
+int32_t cosTab[256], sinTab[256];  // cos and sin of each bin (Q30), looked
+                                   // up from the sine table on the watch.
+
+/**
+ * Returns the number of bins calculated in SD_MODE_GOERTZEL, as
+ * analysis_plan_build() sets plan.nTop - up to the top of the simplified
+ * spectrum (10 Hz) or of the region of interest, whichever is higher.
+ */
+static int plan_top(int nSamp, int freqRes, int nMax) {
+  int nTop = 1 + 10000/freqRes;
+  if (nMax>nTop) nTop = nMax;
+  if (nTop>nSamp/2) nTop = nSamp/2;
+  return nTop;
+}
+
+/**
+ * Run the window through the Goertzel filters for bins kMin to kMax-1,
+ * GOERTZEL_STEP_SAMPLES at a time as goertzel_step() does, leaving the
+ * un-scaled bins in re[] and im[].
+ */
+static void goertzel_window(int nSamp, int kMin, int kMax, int32_t mean,
+			    int32_t *re, int32_t *im) {
+  int k,pos,n;
+  for (k=kMin;k<kMax;k++) re[k] = im[k] = 0;
+  for (pos=0;pos<nSamp;pos+=n) {
+    n = nSamp - pos;
+    if (n>GOERTZEL_STEP_SAMPLES) n = GOERTZEL_STEP_SAMPLES;
+    for (k=kMin;k<kMax;k++)
+      goertzel_run(accData,nSamp,pos,n,mean,cosTab[k],&re[k],&im[k]);
+  }
+  for (k=kMin;k<kMax;k++)
+    goertzel_result(re[k],im[k],cosTab[k],sinTab[k],&re[k],&im[k]);
+}
+
+/**
+ * Run the benchmark for one window length.
+ */
+static void bench(int nSamp, int fftBits) {
+  int i,k,rep;
+  int freqRes = 1000*SAMP_FREQ/nSamp;
+  int nMax = 1000*FREQ_MAX/freqRes;
+  int nMin = 1000*FREQ_MIN/freqRes;
+  int nTop = plan_top(nSamp,freqRes,nMax);
+  int32_t mean = 0;
+  int32_t re[256], im[256];
+  uint64_t t0, tFft, tGoertzel, tRoi;
+  double maxErr = 0, pMax = 0;
+
+  // accData is 16 bit, as on the watch.
+  populate_data(fftBuf,nSamp,SAMP_FREQ,5,300,50);
+  for (i=0;i<nSamp;i++) accData[i] = fftBuf[i];
+  for (k=0;k<nSamp/2;k++) {
+    cosTab[k] = (int32_t)(cos(2*M_PI*k/nSamp)*(1<<30));
+    sinTab[k] = (int32_t)(sin(2*M_PI*k/nSamp)*(1<<30));
+  }
+
+  // FFT - widen the buffer into the work space and transform it, as
+  // analysis_handoff() does.
+  t0 = bench_time();
+  for (rep=0;rep<NREPEAT;rep++) {
+    for (i=0;i<nSamp;i++) fftBuf[i] = accData[i];
+    fft_fftr((fft_complex_t*)fftBuf,fftBits);
+  }
+  tFft = (bench_time()-t0)/NREPEAT;
+
+  // The mean (and energy) come from the running sums kept by
+  // accel_handler(), so they cost nothing here.
+  for (i=0;i<nSamp;i++) mean += accData[i];
+  mean /= nSamp;
+
+  // Goertzel - the bins SD_MODE_GOERTZEL calculates (plan.nTop).
+  t0 = bench_time();
+  for (rep=0;rep<NREPEAT;rep++)
+    goertzel_window(nSamp,1,nTop,mean,re,im);
+  tGoertzel = (bench_time()-t0)/NREPEAT;
+
+  // Goertzel - region of interest only (no simplified spectrum).
+  t0 = bench_time();
+  for (rep=0;rep<NREPEAT;rep++)
+    goertzel_window(nSamp,nMin,nMax,mean,re,im);
+  tRoi = (bench_time()-t0)/NREPEAT;
+
+  // Compare the bin powers (in fft_fftr() units).
+  goertzel_window(nSamp,1,nTop,mean,re,im);
+  for (k=1;k<nTop;k++) {
+    fft_complex_t *c = (fft_complex_t*)fftBuf;
+    double pFft, pGoertzel;
+    int32_t r = re[k] >> (fftBits-1);
+    int32_t m = im[k] >> (fftBits-1);
+    pFft = (double)c[k].r*c[k].r + (double)c[k].i*c[k].i;
+    pGoertzel = (double)r*r + (double)m*m;
+    if (pGoertzel>pMax) pMax = pGoertzel;
+    if (fabs(pGoertzel-pFft)>maxErr) maxErr = fabs(pGoertzel-pFft);
+  }
+
+  printf("nSamp=%4d  fft=%7lu  goertzel(%2d bins)=%8lu (x%5.2f)  goertzel(ROI, %2d bins)=%7lu (x%4.2f)  max difference=%4.1f%% of peak\n",
+	 nSamp,(unsigned long)tFft,
+	 nTop-1,(unsigned long)tGoertzel,(double)tGoertzel/tFft,
+	 nMax-nMin,(unsigned long)tRoi,(double)tRoi/tFft,
+	 100*maxErr/pMax);
+}
+
+/**
+ * main():  Main programme entry point.
+ */
+int main(void) {
+  sine_init();   // the sine table is generated at run time on the host.
+  printf("goertzel_bench - time per analysis window (CPU cycles)\n");
+  bench(128,6);
+  bench(256,7);
+  bench(512,8);
+  return 0;
+}
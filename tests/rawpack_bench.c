@@ -0,0 +1,188 @@
+/*
+  rawpack_bench.c - check that the three axis raw data encoding (rawpack.c)
+  decodes back to the original samples, and compare its size with the 4
+  byte magnitude per sample that raw mode used to send.
+
+  Usage: rawpack_bench [file]
+  where file holds recorded accelerometer data, one "x,y,z" sample (milli-g)
+  per line, at SAMP_FREQ.  Without a file a simulated recording is used -
+  gravity turning slowly with the wrist, arm movements, a 5 Hz tremor, an
+  impact and sensor noise.
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017.
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "../src/rawpack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* CONFIGURATION */
+#define SAMP_FREQ 100     // Hz
+#define NSAMP_MAX 60000   // longest recording (10 minutes at 100 Hz).
+#define MSG_SAMPLES 100   // samples per message (RAW_MSG_SAMPLES).
+#define MSG_BYTES 400     // bytes per message (sizeof(rawMsg) in comms.c).
+
+int16_t accData[3*NSAMP_MAX];
+int16_t decData[3*NSAMP_MAX];
+uint8_t msg[MSG_BYTES];
+
+static int16_t clamp16(double x) {
+  if (x>32767) return 32767;
+  if (x<-32768) return -32768;
+  return (int16_t)lrint(x);
+}
+
+/**
+ * Fill accData with n samples of simulated wrist movement at SAMP_FREQ,
+ * limited to the +/-4g range of the accelerometer.
+ */
+static void simulate_data(int n) {
+  int i,k;
+  unsigned seed = 12345;
+  for (i=0;i<n;i++) {
+    double t = (double)i/SAMP_FREQ;
+    double roll = 0.8*sin(2*M_PI*0.05*t) + 0.3*sin(2*M_PI*0.31*t);
+    double pitch = 0.5*sin(2*M_PI*0.023*t+1.0);
+    double g[3];
+    g[0] = 1000*sin(pitch);
+    g[1] = 1000*cos(pitch)*sin(roll);
+    g[2] = 1000*cos(pitch)*cos(roll);
+    // Arm movements for part of each minute, with a tremor in the middle.
+    if (fmod(t,60)<20) {
+      g[0] += 300*sin(2*M_PI*0.9*t);
+      g[1] += 200*sin(2*M_PI*1.7*t+0.4);
+    }
+    if ((t>25) && (t<35)) {
+      g[1] += 250*sin(2*M_PI*5.0*t);
+      g[2] += 150*sin(2*M_PI*5.0*t+0.7);
+    }
+    // A fall - a short impact.
+    if ((t>=40) && (t<40.05)) g[2] += 3000;
+    for (k=0;k<3;k++) {
+      seed = seed*1103515245 + 12345;
+      g[k] += (int)((seed>>16)&0x1f) - 16;
+      if (g[k]>4000) g[k] = 4000;
+      if (g[k]<-4000) g[k] = -4000;
+      accData[3*i+k] = clamp16(g[k]);
+    }
+  }
+}
+
+/**
+ * Read "x,y,z" lines from file into accData.  Returns the number of samples.
+ */
+static int read_data(const char *fname) {
+  FILE *f = fopen(fname,"r");
+  char line[128];
+  int x,y,z,n = 0;
+  if (f==NULL) {
+    perror(fname);
+    exit(2);
+  }
+  while ((n<NSAMP_MAX) && (fgets(line,sizeof(line),f)!=NULL)) {
+    if (sscanf(line,"%d,%d,%d",&x,&y,&z)!=3) continue;
+    accData[3*n] = clamp16(x);
+    accData[3*n+1] = clamp16(y);
+    accData[3*n+2] = clamp16(z);
+    n++;
+  }
+  fclose(f);
+  return n;
+}
+
+/**
+ * Send the n samples in accData the way flushRawData() does - messages of
+ * up to MSG_SAMPLES samples in MSG_BYTES bytes - decoding each message into
+ * decData.  Returns 1 if the decoded data matches, and sets *nMsgs and
+ * *nBytes to the number of messages and bytes of raw data sent.
+ */
+static int check_stream(int n, int *nMsgs, long *nBytes) {
+  int pos = 0;
+  *nMsgs = 0;
+  *nBytes = 0;
+  while (pos<n) {
+    int len, nEnc, nDec;
+    int nSend = (n-pos<MSG_SAMPLES) ? n-pos : MSG_SAMPLES;
+    nEnc = rawpack_encode(&accData[3*pos],nSend,msg,MSG_BYTES,&len);
+    nDec = rawpack_decode(msg,len,&decData[3*pos],nEnc);
+    if ((nEnc<1) || (nDec!=nEnc)) {
+      printf("message %d: encoded %d samples, decoded %d\n",*nMsgs,nEnc,nDec);
+      return 0;
+    }
+    pos += nEnc;
+    (*nMsgs)++;
+    *nBytes += len;
+  }
+  if (memcmp(accData,decData,3*n*sizeof(accData[0]))!=0) {
+    printf("decoded data does not match\n");
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Check that blocks with the largest possible changes between samples
+ * survive, and that corrupt blocks are rejected rather than overrunning.
+ */
+static int check_extremes() {
+  int i,len,n,ok = 1;
+  for (i=0;i<3*MSG_SAMPLES;i++)
+    accData[i] = ((i/3)&1) ? 32767 : -32768;
+  n = rawpack_encode(accData,MSG_SAMPLES,msg,MSG_BYTES,&len);
+  ok &= (len<=MSG_BYTES);
+  ok &= (rawpack_decode(msg,len,decData,n)==n);
+  ok &= (memcmp(accData,decData,3*n*sizeof(accData[0]))==0);
+  printf("full scale steps: %d samples in %d bytes (%.1f bytes/sample)\n",
+	 n,len,(double)len/n);
+  // A block cut short in the middle of a varint.
+  ok &= (rawpack_decode(msg,len-1,decData,n)==-1);
+  // More samples than there is room for.
+  ok &= (rawpack_decode(msg,len,decData,n-1)==-1);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int n, nMsgs, ok;
+  long nBytes;
+  if (argc>1) {
+    n = read_data(argv[1]);
+    printf("%s: %d samples\n",argv[1],n);
+  } else {
+    n = NSAMP_MAX;
+    simulate_data(n);
+    printf("simulated recording: %d samples\n",n);
+  }
+  if (n==0) return 2;
+  ok = check_stream(n,&nMsgs,&nBytes);
+  printf("magnitude (int32): %7d bytes, %4d messages, 4.0 bytes/sample\n",
+	 4*n,(n+MSG_SAMPLES-1)/MSG_SAMPLES);
+  printf("x,y,z (rawpack):   %7ld bytes, %4d messages, %.2f bytes/sample (x%.2f of magnitude, x%.2f of int16 x,y,z)\n",
+	 nBytes,nMsgs,(double)nBytes/n,nBytes/(4.0*n),nBytes/(6.0*n));
+  ok &= check_extremes();
+  printf("%s\n",ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
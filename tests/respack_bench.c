@@ -0,0 +1,241 @@
+/*
+  respack_bench.c - compare the size and encoding time of the packed
+  results record (respack.c) with the dictionary of separate keys that
+  sendSdData() used to send, and check the record decodes back to the
+  original values (within the precision of the log scaled fields).
+  The dictionary is built by a copy of the Pebble dictionary format (a 7
+  byte header for each value), so its time is only a guide.
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017.
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "../src/respack.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* CONFIGURATION */
+#define NREPEAT 100000   // Number of times to repeat each encoding.
+#define NRANDOM 1000000  // Number of random values to check ulog with.
+
+uint8_t msg[512];        // OUTBOX_SIZE
+
+static unsigned seed = 12345;
+static uint32_t rnd() {
+  seed = seed*1103515245 + 12345;
+  return seed>>8;
+}
+
+// A random value spread evenly over the log scale, up to 2^32-1.
+static uint32_t rnd_log() {
+  int bits = rnd()%33;
+  uint64_t v = ((uint64_t)rnd()<<8 ^ rnd()) & ((1ull<<bits)-1);
+  return (uint32_t)v;
+}
+
+/**
+ * Dictionary in the Pebble format - a count, then for each value a 4 byte
+ * key, 1 byte type and 2 byte length followed by the data.
+ */
+static int dictPos;
+static void dict_begin() {
+  msg[0] = 0;
+  dictPos = 1;
+}
+static void dict_write(uint32_t key, const void *data, int n) {
+  memcpy(&msg[dictPos],&key,4);
+  msg[dictPos+4] = 0;
+  msg[dictPos+5] = (uint8_t)n;
+  msg[dictPos+6] = (uint8_t)(n>>8);
+  memcpy(&msg[dictPos+7],data,n);
+  dictPos += 7+n;
+  msg[0]++;
+}
+static void dict_write_uint8(uint32_t key, uint8_t v) { dict_write(key,&v,1); }
+static void dict_write_uint32(uint32_t key, uint32_t v) { dict_write(key,&v,4); }
+
+/**
+ * Build the results the way writeSdData() does with RESULTS_FORMAT_KEYS.
+ * Returns the size of the dictionary.
+ */
+static int encode_keys(const struct sd_results *r) {
+  int32_t spec[10];
+  int i;
+  dict_begin();
+  dict_write_uint8(1,1);
+  dict_write_uint8(2,(uint8_t)r->alarmState);
+  dict_write_uint32(3,r->maxVal);
+  dict_write_uint32(4,(uint32_t)r->maxFreq);
+  dict_write_uint32(50,(uint32_t)r->peakFreq);
+  dict_write_uint32(51,(uint32_t)r->specCentroid);
+  dict_write_uint32(52,(uint32_t)r->roiPeakRatio);
+  dict_write_uint32(5,r->specPower);
+  dict_write_uint32(15,r->roiPower);
+  dict_write_uint32(38,(uint32_t)r->alarmRoi);
+  dict_write_uint32(40,r->numDropped);
+  dict_write_uint32(41,r->analysisLatency);
+  dict_write_uint32(43,r->maxBlockTime);
+  dict_write_uint32(45,r->numSkipped);
+  dict_write_uint32(47,(uint32_t)r->sampleFreq);
+  dict_write_uint32(57,(uint32_t)r->commsQueued);
+  dict_write_uint32(58,r->commsDropped);
+  dict_write_uint32(59,r->commsRetries);
+  dict_write_uint32(60,r->commsCoalesced);
+  for (i=0;i<10;i++) spec[i] = r->simpleSpec[i];
+  dict_write(14,spec,sizeof(spec));
+  if (r->haveAxes) {
+    dict_write(53,r->axisRoiPowers,sizeof(r->axisRoiPowers));
+    dict_write(54,r->axisSpecPowers,sizeof(r->axisSpecPowers));
+  }
+  return dictPos;
+}
+
+/**
+ * Build the results the way writeSdData() does with RESULTS_FORMAT_PACKED.
+ * Returns the size of the dictionary.
+ */
+static int encode_packed(const struct sd_results *r) {
+  uint8_t buf[RESPACK_SIZE_MAX];
+  dict_begin();
+  dict_write_uint8(1,1);
+  dict_write(61,buf,respack_encode(r,buf));
+  return dictPos;
+}
+
+static void example_results(struct sd_results *r, int haveAxes) {
+  static const uint32_t spec[10] = {84,90,438,778,22740,46936,1305,4108,5762,2376};
+  int i;
+  memset(r,0,sizeof(*r));
+  r->alarmState = 2;
+  r->alarmRoi = 1;
+  r->sampleFreq = 25;
+  r->maxFreq = 5;
+  r->roiPeakRatio = 70;
+  r->specPower = 1411;
+  r->roiPower = 9952;
+  r->maxVal = 325;
+  r->peakFreq = 5012;
+  r->specCentroid = 4876;
+  r->analysisLatency = 12;
+  r->maxBlockTime = 4;
+  for (i=0;i<10;i++) r->simpleSpec[i] = spec[i];
+  r->haveAxes = haveAxes;
+  for (i=0;i<3;i++) {
+    r->axisRoiPowers[i] = 3000+i*500;
+    r->axisSpecPowers[i] = 400+i*60;
+  }
+}
+
+/**
+ * Time NREPEAT encodings of r - returns the time per encoding.
+ */
+static double time_encode(int (*encode)(const struct sd_results*),
+			  struct sd_results *r, int *size) {
+  uint64_t t0,t1;
+  int i;
+  t0 = bench_time();
+  for (i=0;i<NREPEAT;i++) {
+    r->specPower = 1000 + (i&0xff);   // so the loop is not optimised out.
+    *size = encode(r);
+  }
+  t1 = bench_time();
+  return (double)(t1-t0)/NREPEAT;
+}
+
+/**
+ * Largest relative error of ulog values with bits mantissa bits, and check
+ * that values below 2^bits are exact.
+ */
+static double check_ulog(int bits, int codeBits, int *ok) {
+  double err, errMax = 0;
+  uint32_t v,code,d;
+  int i;
+  for (i=0;i<NRANDOM;i++) {
+    v = (i<(1<<bits)) ? (uint32_t)i : (i==(1<<bits)) ? 0xffffffffu : rnd_log();
+    code = respack_ulog(v,bits);
+    d = respack_unlog(code,bits);
+    if (code>=(1u<<codeBits)) *ok = 0;
+    if ((v<(1u<<bits)) && (d!=v)) *ok = 0;
+    err = (v==0) ? 0 : ((double)d-v)/v;
+    if (err<0) err = -err;
+    if (err>errMax) errMax = err;
+  }
+  if (errMax>1.0/(2<<bits)) *ok = 0;
+  return errMax;
+}
+
+/**
+ * Check that the fields that are not log scaled decode exactly (counters
+ * modulo 2^16).
+ */
+static int check_fields() {
+  struct sd_results r, d;
+  uint8_t buf[RESPACK_SIZE_MAX];
+  int n, ok = 1;
+  example_results(&r,1);
+  r.numDropped = 70000;
+  r.commsRetries = 3;
+  n = respack_encode(&r,buf);
+  ok &= (n==RESPACK_SIZE_MAX);
+  ok &= (respack_decode(buf,n,&d)==RESPACK_VERSION);
+  ok &= (d.alarmState==r.alarmState) && (d.alarmRoi==r.alarmRoi);
+  ok &= (d.sampleFreq==r.sampleFreq) && (d.maxFreq==r.maxFreq);
+  ok &= (d.roiPeakRatio==r.roiPeakRatio) && (d.peakFreq==r.peakFreq);
+  ok &= (d.specCentroid==r.specCentroid) && (d.maxVal==r.maxVal);
+  ok &= (d.numDropped==(70000 & 0xffff)) && (d.commsRetries==3);
+  ok &= d.haveAxes && (d.axisRoiPowers[2]==r.axisRoiPowers[2]);
+  r.haveAxes = 0;
+  n = respack_encode(&r,buf);
+  ok &= (n==RESPACK_SIZE_MIN);
+  ok &= (respack_decode(buf,n,&d)==RESPACK_VERSION) && !d.haveAxes;
+  ok &= (respack_decode(buf,n-1,&d)==-1);
+  return ok;
+}
+
+int main(void) {
+  struct sd_results r;
+  int axes, sizeKeys, sizePacked, ok = 1;
+  double tKeys, tPacked, err16, err8;
+
+  for (axes=0;axes<2;axes++) {
+    example_results(&r,axes);
+    tKeys = time_encode(encode_keys,&r,&sizeKeys);
+    tPacked = time_encode(encode_packed,&r,&sizePacked);
+    printf("%-12s keys: %3d bytes %6.0f  packed: %3d bytes %6.0f  (size x%.2f)\n",
+	   axes ? "with axes" : "results",sizeKeys,tKeys,sizePacked,tPacked,
+	   (double)sizePacked/sizeKeys);
+  }
+  printf("(times are %s per message)\n",
+#if defined(__x86_64__) || defined(__i386__)
+	 "cycles"
+#else
+	 "ns"
+#endif
+	 );
+  err16 = check_ulog(11,16,&ok);
+  err8 = check_ulog(3,8,&ok);
+  printf("ulog16 max error %.4f%%, ulog8 (spectrum) max error %.2f%%\n",
+	 100*err16,100*err8);
+  ok &= check_fields();
+  printf("%s\n",ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
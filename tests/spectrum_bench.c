@@ -0,0 +1,218 @@
+/*
+  spectrum_bench.c - compare the cost of reducing a spectrum with the fused
+  single pass kernel in spectrum.c with the separate loops it replaced.
+
+  See http://openseizuredetector.org for more information.
+
+  Copyright Graham Jones, 2015, 2016, 2017.
+
+  This file is part of pebble_sd.
+
+  Pebble_sd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Pebble_sd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with pebble_sd.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* These undefines prevent SYLT-FFT using assembler code */
+#undef __ARMCC_VERSION
+#undef __arm__
+#include "../src/SYLT-FFT/fft.h"
+#include "../src/spectrum.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* CONFIGURATION */
+#define SAMP_FREQ 25     // Sample Frequency in Hz
+#define FREQ_MIN 3       // Region of interest (Hz)
+#define FREQ_MAX 8
+#define FREQ_CUTOFF 12   // Hz
+#define TONE_FREQ 5.3    // Hz - frequency of the test signal.
+#define NREPEAT 20000    // Number of times to repeat each calculation.
+#define NSAMP_MAX 512
+
+int32_t accData[NSAMP_MAX];
+fft_complex_t fftData[NSAMP_MAX/2];
+short fftResults[NSAMP_MAX/2];
+spec_cum_t specCum[NSAMP_MAX/2+1];
+
+// Results of the two reductions.
+struct results {
+  long specPower, roiPower;
+  long roiPowers[4];
+  int simpleSpec[10];
+};
+
+static int getMagnitude(fft_complex_t c) {
+  return c.r*c.r + c.i*c.i;
+}
+
+/**
+ * The reduction as it was before spectrum.c - a separate loop over the
+ * spectrum for each band.
+ */
+static void reduce_loops(int nSamp, int nMin, int nMax, int nFreqCutoff,
+			 int freqRes, int *nMins, int *nMaxs,
+			 struct results *r) {
+  int i,n;
+  r->specPower = 0;
+  for (i=1;i<nSamp/2;i++) {
+    if (i<=nFreqCutoff) {
+      r->specPower = r->specPower + getMagnitude(fftData[i]);
+    }
+    fftResults[i] = (i<=nFreqCutoff) ? getMagnitude(fftData[i]) : 0;
+  }
+  r->roiPower = 0;
+  for (i=nMin;i<nMax;i++)
+    r->roiPower = r->roiPower + getMagnitude(fftData[i]);
+  r->roiPower = r->roiPower/(nMax-nMin);
+  for (n=0;n<4;n++) {
+    r->roiPowers[n] = 0;
+    for (i=nMins[n];i<nMaxs[n];i++)
+      r->roiPowers[n] = r->roiPowers[n] + getMagnitude(fftData[i]);
+    r->roiPowers[n] = r->roiPowers[n]/(nMaxs[n]-nMins[n]);
+  }
+  for (int ifreq=0;ifreq<10;ifreq++) {
+    int binMin = 1 + 1000*ifreq/freqRes;
+    int binMax = 1 + 1000*(ifreq+1)/freqRes;
+    r->simpleSpec[ifreq] = 0;
+    for (int ibin=binMin;ibin<binMax;ibin++)
+      r->simpleSpec[ifreq] = r->simpleSpec[ifreq] + getMagnitude(fftData[ibin]);
+    r->simpleSpec[ifreq] = r->simpleSpec[ifreq] / (binMax-binMin);
+  }
+}
+
+// Band tables, as the analysis plan in analysis.c - bands 0-3 are the
+// ROIs, 4-13 the simplified spectrum.
+int bandMins[14], bandMaxs[14];
+struct spec_recip bandRecips[14];
+
+/**
+ * Set up the band tables (done once per configuration on the watch).
+ */
+static void plan_bands(int freqRes, int *nMins, int *nMaxs) {
+  int n;
+  for (n=0;n<14;n++) {
+    if (n<4) {
+      bandMins[n] = nMins[n];
+      bandMaxs[n] = nMaxs[n];
+    } else {
+      bandMins[n] = 1 + 1000*(n-4)/freqRes;
+      bandMaxs[n] = 1 + 1000*(n-3)/freqRes;
+    }
+    spec_recip_init(&bandRecips[n],bandMaxs[n]-bandMins[n]);
+  }
+}
+
+/**
+ * The reduction done by analysis_reduce() - one pass of spec_features(),
+ * then each band from the cumulative power and the band tables.
+ */
+static void reduce_fused(int nSamp, int nMin, int nMax, int nFreqCutoff,
+			 struct results *r, struct spec_features *f) {
+  int n;
+  spec_features((int32_t*)fftData,0,nSamp/2,nFreqCutoff,nMin,nMax,
+		specCum,fftResults,f);
+  r->specPower = f->power;
+  for (n=0;n<4;n++)
+    r->roiPowers[n] = spec_recip_div64(specCum[bandMaxs[n]]
+				       -specCum[bandMins[n]],&bandRecips[n]);
+  r->roiPower = r->roiPowers[0];
+  for (n=0;n<10;n++)
+    r->simpleSpec[n] = spec_recip_div64(specCum[bandMaxs[n+4]]
+					-specCum[bandMins[n+4]],
+					&bandRecips[n+4]);
+}
+
+/**
+ * Check spec_recip_div() against division for a range of divisors and
+ * numerators - returns the number of wrong results.
+ */
+static int check_recip() {
+  int d,i,nBad = 0;
+  struct spec_recip r;
+  srand(2);
+  for (d=1;d<=NSAMP_MAX;d++) {
+    spec_recip_init(&r,d);
+    for (i=0;i<1000;i++) {
+      uint32_t x = ((uint32_t)rand()<<17) ^ (uint32_t)rand();
+      if (i==0) x = 0xffffffff;
+      if (spec_recip_div(x,&r)!=x/d) nBad++;
+    }
+  }
+  return nBad;
+}
+
+/**
+ * Run the benchmark for one window length.
+ */
+static void bench(int nSamp, int fftBits) {
+  int rep;
+  int freqRes = 1000*SAMP_FREQ/nSamp;
+  int nMin = 1000*FREQ_MIN/freqRes;
+  int nMax = 1000*FREQ_MAX/freqRes;
+  int nFreqCutoff = 1000*FREQ_CUTOFF/freqRes;
+  int nMins[4], nMaxs[4];
+  uint64_t t0, tLoops, tFused;
+  struct results rLoops, rFused;
+  struct spec_features f;
+  volatile long sink = 0;
+
+  nMins[0] = nMin;                      nMaxs[0] = nMax;
+  nMins[1] = nMin;                      nMaxs[1] = (nMin+nMax)/2;
+  nMins[2] = (nMin+nMax)/2;             nMaxs[2] = nMax;
+  nMins[3] = nMin + (nMax-nMin)/4;      nMaxs[3] = nMax - (nMax-nMin)/4;
+
+  populate_data(accData,nSamp,SAMP_FREQ,TONE_FREQ,300,50);
+  memcpy(fftData,accData,nSamp*sizeof(accData[0]));
+  fft_fftr(fftData,fftBits);
+
+  t0 = bench_time();
+  for (rep=0;rep<NREPEAT;rep++) {
+    reduce_loops(nSamp,nMin,nMax,nFreqCutoff,freqRes,nMins,nMaxs,&rLoops);
+    sink += rLoops.roiPower;
+  }
+  tLoops = (bench_time()-t0)/NREPEAT;
+
+  plan_bands(freqRes,nMins,nMaxs);
+  t0 = bench_time();
+  for (rep=0;rep<NREPEAT;rep++) {
+    reduce_fused(nSamp,nMin,nMax,nFreqCutoff,&rFused,&f);
+    sink += rFused.roiPower;
+  }
+  tFused = (bench_time()-t0)/NREPEAT;
+
+  printf("nSamp=%4d  loops=%6lu  fused=%6lu (x%4.2f)  results %s  peak=%.2f Hz (bin %d)  centroid=%.2f Hz  ROI peak/mean=%.1f\n",
+	 nSamp,(unsigned long)tLoops,(unsigned long)tFused,
+	 (double)tFused/tLoops,
+	 memcmp(&rLoops,&rFused,sizeof(rLoops))==0 ? "match" : "DIFFER",
+	 (double)f.peakPos*freqRes/(1000<<SPEC_FRAC_BITS),f.peakBin,
+	 (double)f.centroid*freqRes/(1000<<SPEC_FRAC_BITS),
+	 f.roiPeakRatio/10.0);
+}
+
+/**
+ * main():  Main programme entry point.
+ */
+int main(void) {
+  sine_init();   // the sine table is generated at run time on the host.
+  printf("spectrum_bench - time per spectrum reduction (CPU cycles), %.1f Hz tone\n",
+	 TONE_FREQ);
+  bench(128,6);
+  bench(256,7);
+  bench(512,8);
+  printf("spec_recip_div() errors: %d\n",check_recip());
+  return 0;
+}